@@ -5,8 +5,12 @@
  * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
  */
 
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cstdlib>
 #include <memory>
 #include <iostream>
+#include <thread>
 #include "buffer.h"
 #include "bufHashTbl.h"
 #include "exceptions/hash_already_present_exception.h"
@@ -15,100 +19,258 @@
 
 namespace badgerdb {
 
-int BufHashTbl::hash(const File* file, const PageId pageNo)
+/**
+ * Finalizer of MurmurHash3: every input bit affects every output bit.
+ */
+static inline std::uint64_t mix64(std::uint64_t h)
 {
-  int tmp, value;
-  tmp = (long)file;  // cast of pointer to the file object to an integer
-  value = (tmp + pageNo) % HTSIZE;
-  return value;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
 }
 
-BufHashTbl::BufHashTbl(int htSize)
-	: HTSIZE(htSize)
+std::uint64_t BufHashTbl::hash(const File* file, const PageId pageNo) const
 {
-  // allocate an array of pointers to hashBuckets
-  ht = new hashBucket* [htSize];
-  for(int i=0; i < HTSIZE; i++)
-    ht[i] = NULL;
+  std::uint64_t key = reinterpret_cast<std::uintptr_t>(file);
+  key ^= (std::uint64_t) pageNo * 0x9e3779b97f4a7c15ULL;
+  return mix64(key);
 }
 
-BufHashTbl::~BufHashTbl()
+std::uint32_t BufHashTbl::partition(const std::uint64_t hashValue) const
 {
-  for(int i = 0; i < HTSIZE; i++) {
-    hashBucket* tmpBuf = ht[i];
-    while (ht[i]) {
-      tmpBuf = ht[i];
-      ht[i] = ht[i]->next;
-      delete tmpBuf;
-    }
+  return (hashValue >> 32) % numPartitions;
+}
+
+void BufHashTbl::beginWrite(const std::uint32_t part)
+{
+  std::atomic<std::uint32_t>& version = partitions[part].version;
+  version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  // Readers that see any of the following slot changes also see the odd
+  // sequence number.
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+void BufHashTbl::endWrite(const std::uint32_t part)
+{
+  std::atomic<std::uint32_t>& version = partitions[part].version;
+  version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+hashBucket* BufHashTbl::bank(const std::uint32_t part, const std::uint32_t which) const
+{
+  return banks + (2 * (std::size_t) part + which) * maxSize;
+}
+
+BufHashTbl::BufHashTbl(int htSize, std::uint32_t maxEntries, int partitionCount)
+	: numPartitions(partitionCount < htSize ? partitionCount : htSize)
+{
+  // Size every partition for four times its share of the entries, so that
+  // probes stay short and an unlucky spread does not make it grow at once.
+  std::uint32_t wanted = 4 * (std::uint32_t) htSize / numPartitions;
+  std::uint32_t size = 16;
+  while (size < wanted)
+    size *= 2;
+
+  // Banks are whole pages, so that a bank left behind can be handed back.
+  if (maxEntries < (std::uint32_t) htSize)
+    maxEntries = htSize;
+  const std::uint64_t most = 4 * (std::uint64_t) maxEntries / numPartitions;
+  maxSize = size;
+  while (maxSize < most || maxSize * sizeof(hashBucket) % sysconf(_SC_PAGESIZE) != 0)
+    maxSize *= 2;
+  // Anonymous pages read as zeros, which is an empty slot.
+  reservedBytes = 2 * (std::size_t) numPartitions * maxSize * sizeof(hashBucket);
+  void* reserved = mmap(NULL, reservedBytes, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (reserved == MAP_FAILED)
+    throw HashTableException();
+  banks = static_cast<hashBucket*>(reserved);
+
+  void* block;
+  if (posix_memalign(&block, 64, numPartitions * sizeof(Partition)) != 0) {
+    munmap(reserved, reservedBytes);
+    throw HashTableException();
+  }
+  partitions = static_cast<Partition*>(block);
+  for (int i = 0; i < numPartitions; i++) {
+    new (&partitions[i]) Partition();
+    partitions[i].version = 0;
+    partitions[i].size = size;
+    partitions[i].slots = bank(i, 0);
+    partitions[i].count = 0;
   }
-  delete [] ht;
 }
 
-void BufHashTbl::insert(const File* file, const PageId pageNo, const FrameId frameNo)
+BufHashTbl::~BufHashTbl()
 {
-  int index = hash(file, pageNo);
+  for (int i = 0; i < numPartitions; i++)
+    partitions[i].~Partition();
+  free(partitions);
+  munmap(banks, reservedBytes);
+}
 
-  hashBucket* tmpBuc = ht[index];
-  while (tmpBuc) {
-    if (tmpBuc->file == file && tmpBuc->pageNo == pageNo)
-  		throw HashAlreadyPresentException(tmpBuc->file->filename(), tmpBuc->pageNo, tmpBuc->frameNo);
-    tmpBuc = tmpBuc->next;
+void BufHashTbl::grow(const std::uint32_t part)
+{
+  Partition& p = partitions[part];
+  hashBucket* old = p.slots;
+  const std::uint32_t oldSize = p.size;
+  const std::uint32_t size = 2 * oldSize;
+  // The other bank is empty: never touched, or handed back by the last grow.
+  hashBucket* slot = old == bank(part, 0) ? bank(part, 1) : bank(part, 0);
+  const std::uint32_t mask = size - 1;
+  for (std::uint32_t j = 0; j < oldSize; j++) {
+    File* file = old[j].file;
+    if (file == NULL)
+      continue;
+    std::uint32_t i = hash(file, old[j].pageNo) & mask;
+    while (slot[i].file != NULL)
+      i = (i + 1) & mask;
+    slot[i].file = file;
+    slot[i].pageNo = old[j].pageNo.load();
+    slot[i].frameNo = old[j].frameNo.load();
   }
 
-  tmpBuc = new hashBucket;
-  if (!tmpBuc)
-  	throw HashTableException();
+  beginWrite(part);
+  p.slots.store(slot, std::memory_order_relaxed);
+  p.size.store(size, std::memory_order_relaxed);
+  endWrite(part);
 
-  tmpBuc->file = (File*) file;
-  tmpBuc->pageNo = pageNo;
-  tmpBuc->frameNo = frameNo;
-  tmpBuc->next = ht[index];
-  ht[index] = tmpBuc;
+  // Lookups may still be probing the old bank; after this they read empty
+  // slots there, and retry as the sequence number has changed.
+  madvise(old, (std::size_t) oldSize * sizeof(hashBucket), MADV_DONTNEED);
 }
 
-void BufHashTbl::lookup(const File* file, const PageId pageNo, FrameId &frameNo)
+std::mutex& BufHashTbl::latch(const File* file, const PageId pageNo)
 {
-  int index = hash(file, pageNo);
-  hashBucket* tmpBuc = ht[index];
-  while (tmpBuc) {
-    if (tmpBuc->file == file && tmpBuc->pageNo == pageNo)
-    {
-      frameNo = tmpBuc->frameNo; // return frameNo by reference
-      return;
-    }
-    tmpBuc = tmpBuc->next;
+  return partitions[partition(hash(file, pageNo))].latch;
+}
+
+void BufHashTbl::insert(const File* file, const PageId pageNo, const FrameId frameNo)
+{
+  if (!tryInsert(file, pageNo, frameNo)) {
+    FrameId present;
+    find(file, pageNo, present);
+    throw HashAlreadyPresentException(file->filename(), pageNo, present);
   }
+}
 
-  throw HashNotFoundException(file->filename(), pageNo);
+void BufHashTbl::lookup(const File* file, const PageId pageNo, FrameId &frameNo)
+{
+  if (!find(file, pageNo, frameNo))
+    throw HashNotFoundException(file->filename(), pageNo);
 }
 
 void BufHashTbl::remove(const File* file, const PageId pageNo) {
+  if (!erase(file, pageNo))
+    throw HashNotFoundException(file->filename(), pageNo);
+}
+
+bool BufHashTbl::find(const File* file, const PageId pageNo, FrameId &frameNo) const
+{
+  const std::uint64_t h = hash(file, pageNo);
+  const Partition& p = partitions[partition(h)];
+  for (;;) {
+    const std::uint32_t before = p.version.load(std::memory_order_acquire);
+    if (before & 1) {
+      // A writer is moving entries around; let it finish.
+      std::this_thread::yield();
+      continue;
+    }
 
-  int index = hash(file, pageNo);
-  hashBucket* tmpBuc = ht[index];
-  hashBucket* prevBuc = NULL;
-
-  while (tmpBuc)
-	{
-    if (tmpBuc->file == file && tmpBuc->pageNo == pageNo)
-		{
-      if(prevBuc)
-				prevBuc->next = tmpBuc->next;
-      else
-				ht[index] = tmpBuc->next;
-
-      delete tmpBuc;
-      return;
+    const hashBucket* slot = p.slots.load(std::memory_order_relaxed);
+    const std::uint32_t size = p.size.load(std::memory_order_relaxed);
+    const std::uint32_t mask = size - 1;
+    bool found = false;
+    FrameId frame = 0;
+    for (std::uint32_t i = h & mask, n = 0; n < size; i = (i + 1) & mask, n++) {
+      const File* slotFile = slot[i].file.load(std::memory_order_relaxed);
+      if (slotFile == NULL)
+        break;
+      if (slotFile == file && slot[i].pageNo.load(std::memory_order_relaxed) == pageNo) {
+        frame = slot[i].frameNo.load(std::memory_order_relaxed);
+        found = true;
+        break;
+      }
     }
-		else
-		{
-      prevBuc = tmpBuc;
-      tmpBuc = tmpBuc->next;
+
+    // What was read is only valid if no writer started in the meantime.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (p.version.load(std::memory_order_relaxed) == before) {
+      if (found)
+        frameNo = frame; // return frameNo by reference
+      return found;
     }
   }
+}
+
+bool BufHashTbl::tryInsert(const File* file, const PageId pageNo, const FrameId frameNo)
+{
+  const std::uint64_t h = hash(file, pageNo);
+  const std::uint32_t part = partition(h);
+  Partition& p = partitions[part];
+  if (2 * (p.count + 1) > p.size) {
+    if (p.size < maxSize)
+      grow(part);
+    else if (p.count + 1 == p.size)
+      throw HashTableException();  // keep an empty slot to end every probe
+  }
+  hashBucket* slot = p.slots;
+  const std::uint32_t mask = p.size - 1;
+  // At most half of the slots are in use, so the probe ends at an empty one.
+  std::uint32_t i = h & mask;
+  for (; slot[i].file != NULL; i = (i + 1) & mask) {
+    if (slot[i].file == file && slot[i].pageNo == pageNo)
+      return false;
+  }
+  beginWrite(part);
+  slot[i].pageNo.store(pageNo, std::memory_order_relaxed);
+  slot[i].frameNo.store(frameNo, std::memory_order_relaxed);
+  slot[i].file.store((File*) file, std::memory_order_relaxed);
+  endWrite(part);
+  p.count++;
+  return true;
+}
+
+bool BufHashTbl::erase(const File* file, const PageId pageNo)
+{
+  const std::uint64_t h = hash(file, pageNo);
+  const std::uint32_t part = partition(h);
+  Partition& p = partitions[part];
+  hashBucket* slot = p.slots;
+  const std::uint32_t mask = p.size - 1;
+  std::uint32_t hole = h & mask;
+  while (slot[hole].file != file || slot[hole].pageNo != pageNo) {
+    if (slot[hole].file == NULL)
+      return false;
+    hole = (hole + 1) & mask;
+  }
 
-  throw HashNotFoundException(file->filename(), pageNo);
+  // Shift later entries of the probe sequence back into the hole, so that
+  // lookups never stop early at it.
+  beginWrite(part);
+  for (std::uint32_t i = (hole + 1) & mask; slot[i].file != NULL; i = (i + 1) & mask) {
+    File* movedFile = slot[i].file.load(std::memory_order_relaxed);
+    const PageId movedPage = slot[i].pageNo.load(std::memory_order_relaxed);
+    const std::uint32_t home = hash(movedFile, movedPage) & mask;
+    // Leave the entry if its home lies cyclically in (hole, i].
+    const bool stays = hole <= i ? (hole < home && home <= i)
+                                 : (hole < home || home <= i);
+    if (!stays) {
+      slot[hole].file.store(movedFile, std::memory_order_relaxed);
+      slot[hole].pageNo.store(movedPage, std::memory_order_relaxed);
+      slot[hole].frameNo.store(slot[i].frameNo.load(std::memory_order_relaxed),
+                               std::memory_order_relaxed);
+      hole = i;
+    }
+  }
+  slot[hole].file.store(NULL, std::memory_order_relaxed);
+  slot[hole].pageNo.store(Page::INVALID_NUMBER, std::memory_order_relaxed);
+  endWrite(part);
+  p.count--;
+  return true;
 }
 
 }
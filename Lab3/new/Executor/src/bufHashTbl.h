@@ -7,73 +7,163 @@
 
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+
 #include "file.h"
 
 namespace badgerdb {
 
 /**
 * @brief Declarations for buffer pool hash table
+*
+* Entries are stored inline in the table; an entry whose file is NULL is
+* empty.  Four entries share a cache line.  The fields are atomic because
+* lookups read them without holding the partition latch.
 */
 struct hashBucket {
 	/**
 	 * pointer a file object (more on this below)
 	 */
-	File *file;
+	std::atomic<File*> file;
 
 	/**
 	 * page number within a file
 	 */
-	PageId pageNo;
+	std::atomic<PageId> pageNo;
 
 	/**
 	 * frame number of page in the buffer pool
 	 */
-	FrameId frameNo;
-
-	/**
-	 * Next node in the hash table
-	 */
-	hashBucket*   next;
+	std::atomic<FrameId> frameNo;
 };
 
 
 /**
 * @brief Hash table class to keep track of pages in the buffer pool
 *
-* @warning This class is not threadsafe.
+* Open addressing with linear probing.  The slots are split into partitions,
+* each a separate table guarded by its own latch, so probing never crosses
+* into another partition.  A partition that becomes half full doubles its
+* slots on the next insert, so the table follows a growing buffer pool one
+* partition at a time.
+*
+* The address space for the slots of the largest table is reserved when the
+* table is constructed, as two banks per partition; the kernel only backs
+* the slots in use with memory.  A partition grows by rehashing its entries
+* into its other bank and then hands the pages of the bank it left back to
+* the kernel.  A lookup still reading the old bank finds empty slots there
+* and retries, so nothing is allocated or freed after construction.
+*
+* Every partition carries a sequence number that writers make odd while
+* they change its slots and even again when done.  find() reads the slots
+* without locking and retries if the sequence number was odd or changed in
+* the meantime, so lookups never block each other.  insert(), remove(),
+* tryInsert() and erase() must be called with latch(file, pageNo) held.
 */
 class BufHashTbl
 {
  private:
 	/**
-	 *	Size of Hash Table
+	 * Number of partitions the slots are split into
 	 */
-  int HTSIZE;
+  int numPartitions;
+
 	/**
-	 * Actual Hash table object
+	 * Number of slots a partition can grow to, the size of each bank
 	 */
-  hashBucket**  ht;
+  std::uint32_t maxSize;
 
 	/**
-	 * returns hash value between 0 and HTSIZE-1 computed using file and pageNo
+	 * Reserved slots: the two banks of partition i are banks 2i and 2i + 1
+	 */
+  hashBucket* banks;
+
+	/**
+	 * Number of bytes reserved for the banks
+	 */
+  std::size_t reservedBytes;
+
+	/**
+	 * A partition: its latch, sequence number and slots, padded to a cache
+	 * line so that writers in one partition do not slow down readers of the
+	 * next.  slots and size only change together, inside a write.
+	 */
+  struct Partition {
+    std::mutex latch;
+    std::atomic<std::uint32_t> version;
+    std::atomic<std::uint32_t> size;      // number of slots, a power of two
+    std::atomic<hashBucket*> slots;
+    std::uint32_t count;                  // number of entries
+    char pad[64 - sizeof(std::mutex) - 3 * sizeof(std::uint32_t) -
+             sizeof(hashBucket*)];
+  };
+
+	/**
+	 * One latch and sequence number per partition
+	 */
+  Partition* partitions;
+
+	/**
+	 * returns a 64-bit hash of file and pageNo.  The high half selects the
+	 * partition, the low half the first slot probed in it.
 	 *
 	 * @param file   	File object
 	 * @param pageNo  Page number in the file
 	 * @return  			Hash value.
 	 */
-  int	 hash(const File* file, const PageId pageNo);
+  std::uint64_t hash(const File* file, const PageId pageNo) const;
+
+	/**
+	 * Returns the index of the partition the hash value belongs to.
+	 */
+  std::uint32_t partition(const std::uint64_t hashValue) const;
+
+	/**
+	 * Returns the first slot of the given bank of the partition.
+	 */
+  hashBucket* bank(const std::uint32_t part, const std::uint32_t which) const;
+
+	/**
+	 * Doubles the slots of the partition, rehashing its entries into its
+	 * other bank.  Caller must hold the partition latch.
+	 */
+  void grow(const std::uint32_t part);
+
+	/**
+	 * Mark the partition as being changed and, when done, as changed.
+	 * Caller must hold the partition latch.
+	 */
+  void beginWrite(const std::uint32_t part);
+  void endWrite(const std::uint32_t part);
 
  public:
 	/**
    * Constructor of BufHashTbl class
+	 *
+	 * @param htSize      Expected number of entries, with some headroom
+	 * @param maxEntries  Largest number of entries the table must hold
+	 * @param partitionCount  Number of independently latched partitions
+	 * @throws  HashTableException if the slots cannot be reserved
 	 */
-	BufHashTbl(const int htSize);  // constructor
+	BufHashTbl(const int htSize, const std::uint32_t maxEntries,
+	           const int partitionCount = 64);  // constructor
 
 	/**
    * Destructor of BufHashTbl class
 	 */
   ~BufHashTbl(); // destructor
 	
+	/**
+   * Returns the latch of the partition holding (file, pageNo).
+	 *
+	 * @param file   	File object
+	 * @param pageNo 	Page number in the file
+	 */
+  std::mutex& latch(const File* file, const PageId pageNo);
+
 	/**
    * Insert entry into hash table mapping (file, pageNo) to frameNo.
 	 *
@@ -81,7 +171,7 @@ class BufHashTbl
 	 * @param pageNo 	Page number in the file
 	 * @param frameNo Frame number assigned to that page of the file
    * @throws  HashAlreadyPresentException	if the corresponding page already exists in the hash table
-   * @throws  HashTableException (optional) if could not create a new bucket as running of memory
+   * @throws  HashTableException if the partition of the page is full
 	 */
   void insert(const File* file, const PageId pageNo, const FrameId frameNo);
 
@@ -104,6 +194,41 @@ class BufHashTbl
    * @throws HashNotFoundException if the page entry is not found in the hash table 
 	 */
   void remove(const File* file, const PageId pageNo);  
+
+	/**
+   * Looks (file, pageNo) up without throwing; for the hit/miss path, where
+   * a missing entry is not an error.  Needs no latch: the result is a
+   * consistent snapshot, but without the latch the entry may be removed
+   * right after it was found.
+	 *
+	 * @param file  	File object
+	 * @param pageNo	Page number in the file
+	 * @param frameNo Frame number returned via this reference if found
+   * @return  False if the page entry is not in the hash table.
+	 */
+  bool find(const File* file, const PageId pageNo, FrameId &frameNo) const;
+
+	/**
+   * Inserts an entry mapping (file, pageNo) to frameNo unless the page is
+   * already present.
+	 *
+	 * @param file   	File object
+	 * @param pageNo 	Page number in the file
+	 * @param frameNo Frame number assigned to that page of the file
+   * @return  False if the page is already in the hash table; nothing is
+   * changed then.
+   * @throws  HashTableException if the partition of the page is full
+	 */
+  bool tryInsert(const File* file, const PageId pageNo, const FrameId frameNo);
+
+	/**
+   * Deletes entry (file, pageNo) from the hash table if present.
+	 *
+	 * @param file   	File object
+	 * @param pageNo  Page number in the file
+   * @return  False if the page entry was not in the hash table.
+	 */
+  bool erase(const File* file, const PageId pageNo);
 };
 
 }
@@ -0,0 +1,240 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include "buf_stats.h"
+
+#include <cstdio>
+#include "file.h"
+
+namespace badgerdb {
+
+std::uint32_t StatCounter::stripe() {
+  static std::atomic<std::uint32_t> next_stripe(0);
+  static thread_local std::uint32_t stripe =
+      next_stripe.fetch_add(1, std::memory_order_relaxed) & (STRIPES - 1);
+  return stripe;
+}
+
+std::uint64_t StatCounter::load() const {
+  std::uint64_t total = 0;
+  for (std::uint32_t i = 0; i < STRIPES; ++i) {
+    total += stripes_[i].value.load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+void StatCounter::clear() {
+  for (std::uint32_t i = 0; i < STRIPES; ++i) {
+    stripes_[i].value.store(0, std::memory_order_relaxed);
+  }
+}
+
+void LatencyHistogram::record(const std::uint64_t nanos) {
+  int i = 0;
+  while (i < BUCKETS - 1 && (nanos >> (i + 1)) != 0) {
+    ++i;
+  }
+  buckets_[i].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(nanos, std::memory_order_relaxed);
+}
+
+std::uint64_t LatencyHistogram::percentile(const double fraction) const {
+  const std::uint64_t total = count();
+  if (total == 0) {
+    return 0;
+  }
+  std::uint64_t rank = static_cast<std::uint64_t>(fraction * total);
+  if (rank >= total) {
+    rank = total - 1;
+  }
+  std::uint64_t seen = 0;
+  for (int i = 0; i < BUCKETS; ++i) {
+    seen += bucket(i);
+    if (seen > rank) {
+      return std::uint64_t(1) << (i + 1);
+    }
+  }
+  return std::uint64_t(1) << BUCKETS;
+}
+
+void LatencyHistogram::clear() {
+  for (int i = 0; i < BUCKETS; ++i) {
+    buckets_[i].store(0, std::memory_order_relaxed);
+  }
+  count_.store(0, std::memory_order_relaxed);
+  sum_.store(0, std::memory_order_relaxed);
+}
+
+/**
+ * Appends "name": value to out, preceded by a comma unless first.
+ */
+static void appendField(std::string& out, const char* name,
+                        const std::uint64_t value, const bool first = false) {
+  char buf[64];
+  std::snprintf(buf, sizeof(buf), "%s\"%s\":%llu", first ? "" : ",", name,
+                static_cast<unsigned long long>(value));
+  out += buf;
+}
+
+/**
+ * Appends s to out as a JSON string.
+ */
+static void appendString(std::string& out, const std::string& s) {
+  out += '"';
+  for (std::size_t i = 0; i < s.size(); ++i) {
+    const unsigned char c = s[i];
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (c < 0x20) {
+      char buf[8];
+      std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out += buf;
+    } else {
+      out += c;
+    }
+  }
+  out += '"';
+}
+
+void LatencyHistogram::toJSON(std::string& out) const {
+  out += '{';
+  appendField(out, "count", count(), true);
+  appendField(out, "sum_ns", sum());
+  appendField(out, "p50_ns", percentile(0.5));
+  appendField(out, "p99_ns", percentile(0.99));
+  out += ",\"buckets\":{";
+  bool first = true;
+  for (int i = 0; i < BUCKETS; ++i) {
+    if (bucket(i) == 0) {
+      continue;
+    }
+    // Keyed by the lower bound of the bucket.
+    char name[24];
+    std::snprintf(name, sizeof(name), "%llu",
+                  static_cast<unsigned long long>(std::uint64_t(1) << i));
+    appendField(out, name, bucket(i), first);
+    first = false;
+  }
+  out += "}}";
+}
+
+namespace {
+
+std::uint64_t nextStatsId() {
+  static std::atomic<std::uint64_t> next(1);
+  return next.fetch_add(1);
+}
+
+}
+
+BufStats::BufStats() : id(nextStatsId()) { clear(); }
+
+BufStats::~BufStats() {
+  for (std::map<std::string, FileCounters*>::iterator it = files.begin();
+       it != files.end(); ++it) {
+    delete it->second;
+  }
+}
+
+void BufStats::addFile(const File* file,
+                       std::atomic<std::uint64_t> FileCounters::*field,
+                       const std::uint64_t n) {
+  FileCounters* counters = static_cast<FileCounters*>(file->ownerSlot(id));
+  if (counters == NULL) {
+    counters = fileCounters(file);
+  }
+  (counters->*field).fetch_add(n, std::memory_order_relaxed);
+}
+
+FileCounters* BufStats::fileCounters(const File* file) {
+  std::lock_guard<std::mutex> guard(filesLatch);
+  FileCounters*& counters = files[file->filename()];
+  if (counters == NULL) {
+    counters = new FileCounters;
+  }
+  file->setOwnerSlot(id, counters);
+  return counters;
+}
+
+std::map<std::string, FileStats> BufStats::fileStats() const {
+  std::map<std::string, FileStats> snapshot;
+  std::lock_guard<std::mutex> guard(filesLatch);
+  for (std::map<std::string, FileCounters*>::const_iterator it = files.begin();
+       it != files.end(); ++it) {
+    FileStats& stats = snapshot[it->first];
+    stats.hits = it->second->hits.load(std::memory_order_relaxed);
+    stats.misses = it->second->misses.load(std::memory_order_relaxed);
+    stats.diskreads = it->second->diskreads.load(std::memory_order_relaxed);
+    stats.diskwrites = it->second->diskwrites.load(std::memory_order_relaxed);
+    stats.evictions = it->second->evictions.load(std::memory_order_relaxed);
+  }
+  return snapshot;
+}
+
+std::string BufStats::toJSON() const {
+  std::string out = "{";
+  appendField(out, "accesses", accesses(), true);
+  appendField(out, "hits", hits);
+  appendField(out, "misses", misses);
+  appendField(out, "allocs", allocs);
+  appendField(out, "diskreads", diskreads);
+  appendField(out, "diskwrites", diskwrites);
+  appendField(out, "evictions", evictions);
+  appendField(out, "dirty_evictions", dirtyEvictions);
+  appendField(out, "flushes", flushes);
+  appendField(out, "pinned_high_water", pinnedHighWater.load());
+  out += ",\"miss_latency\":";
+  missLatency.toJSON(out);
+  out += ",\"write_latency\":";
+  writeLatency.toJSON(out);
+  out += ",\"files\":{";
+  const std::map<std::string, FileStats> snapshot = fileStats();
+  for (std::map<std::string, FileStats>::const_iterator it = snapshot.begin();
+       it != snapshot.end(); ++it) {
+    if (it != snapshot.begin()) {
+      out += ',';
+    }
+    appendString(out, it->first);
+    out += ":{";
+    appendField(out, "hits", it->second.hits, true);
+    appendField(out, "misses", it->second.misses);
+    appendField(out, "diskreads", it->second.diskreads);
+    appendField(out, "diskwrites", it->second.diskwrites);
+    appendField(out, "evictions", it->second.evictions);
+    out += '}';
+  }
+  out += "}}";
+  return out;
+}
+
+void BufStats::clear() {
+  hits.clear();
+  misses.clear();
+  allocs.clear();
+  diskreads.clear();
+  diskwrites.clear();
+  evictions.clear();
+  dirtyEvictions.clear();
+  flushes.clear();
+  pinnedHighWater.store(0);
+  missLatency.clear();
+  writeLatency.clear();
+  // Files may still point at the counters, so zero them in place.
+  std::lock_guard<std::mutex> guard(filesLatch);
+  for (std::map<std::string, FileCounters*>::iterator it = files.begin();
+       it != files.end(); ++it) {
+    it->second->hits.store(0, std::memory_order_relaxed);
+    it->second->misses.store(0, std::memory_order_relaxed);
+    it->second->diskreads.store(0, std::memory_order_relaxed);
+    it->second->diskwrites.store(0, std::memory_order_relaxed);
+    it->second->evictions.store(0, std::memory_order_relaxed);
+  }
+}
+
+}
@@ -0,0 +1,339 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace badgerdb {
+
+class File;
+
+/**
+ * @brief Event counter that threads can bump at once without contending.
+ *
+ * The count is split into stripes, each on its own cache line, and every
+ * thread adds to the stripe it was assigned on first use.  Adding is a
+ * relaxed atomic increment of a line that is rarely shared; reading sums
+ * the stripes and may miss increments made concurrently.
+ */
+class StatCounter {
+ public:
+  /**
+   * Number of stripes, a power of two
+   */
+  static const std::uint32_t STRIPES = 16;
+
+  StatCounter() { clear(); }
+
+  /**
+   * Adds n to the count.
+   */
+  void add(const std::uint64_t n = 1) {
+    stripes_[stripe()].value.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  /**
+   * Returns the count.
+   */
+  std::uint64_t load() const;
+
+  operator std::uint64_t() const { return load(); }
+
+  /**
+   * Resets the count to zero.
+   */
+  void clear();
+
+ private:
+  StatCounter(const StatCounter&);
+  StatCounter& operator=(const StatCounter&);
+
+  /**
+   * Returns the stripe of the calling thread.
+   */
+  static std::uint32_t stripe();
+
+  struct Stripe {
+    std::atomic<std::uint64_t> value;
+    char pad[64 - sizeof(std::atomic<std::uint64_t>)];
+  };
+
+  Stripe stripes_[STRIPES];
+};
+
+/**
+ * @brief Histogram of latencies in power-of-two buckets of nanoseconds.
+ *
+ * Bucket i counts latencies of at least 2^i and less than 2^(i+1) ns, the
+ * last bucket everything longer.  Meant for the miss and write paths, which
+ * wait for the disk anyway; recording is a few relaxed increments.
+ */
+class LatencyHistogram {
+ public:
+  /**
+   * Number of buckets; the last one starts at about 2 seconds
+   */
+  static const int BUCKETS = 32;
+
+  LatencyHistogram() { clear(); }
+
+  /**
+   * Records one latency.
+   *
+   * @param nanos   Latency in nanoseconds
+   */
+  void record(const std::uint64_t nanos);
+
+  /**
+   * Returns the number of latencies recorded.
+   */
+  std::uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+
+  /**
+   * Returns the sum of the latencies recorded, in nanoseconds.
+   */
+  std::uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+
+  /**
+   * Returns the number of latencies in the given bucket.
+   */
+  std::uint64_t bucket(const int i) const {
+    return buckets_[i].load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Returns the latency below which the given fraction of the recorded
+   * latencies lie, rounded up to the end of its bucket, or 0 if none were
+   * recorded.
+   *
+   * @param fraction  Fraction between 0 and 1, e.g. 0.99
+   */
+  std::uint64_t percentile(const double fraction) const;
+
+  /**
+   * Forgets all latencies recorded.
+   */
+  void clear();
+
+  /**
+   * Appends the histogram to out as a JSON object; empty buckets are left
+   * out.
+   */
+  void toJSON(std::string& out) const;
+
+ private:
+  LatencyHistogram(const LatencyHistogram&);
+  LatencyHistogram& operator=(const LatencyHistogram&);
+
+  std::atomic<std::uint64_t> buckets_[BUCKETS];
+  std::atomic<std::uint64_t> count_;
+  std::atomic<std::uint64_t> sum_;
+};
+
+/**
+ * @brief Statistics of buffer usage for the pages of one file
+ */
+struct FileStats {
+  /**
+   * Number of reads of pages of the file found in the buffer pool
+   */
+  std::uint64_t hits;
+
+  /**
+   * Number of reads of pages of the file that missed the buffer pool
+   */
+  std::uint64_t misses;
+
+  /**
+   * Number of pages of the file read from disk, including allocs and
+   * readahead
+   */
+  std::uint64_t diskreads;
+
+  /**
+   * Number of pages of the file written back to disk
+   */
+  std::uint64_t diskwrites;
+
+  /**
+   * Number of pages of the file taken out of the buffer pool
+   */
+  std::uint64_t evictions;
+
+  FileStats()
+      : hits(0), misses(0), diskreads(0), diskwrites(0), evictions(0) {}
+
+  /**
+   * Fraction of the reads of pages of the file found in the buffer pool
+   */
+  double hitRatio() const {
+    return hits + misses == 0 ? 0.0 : double(hits) / double(hits + misses);
+  }
+};
+
+/**
+ * @brief Counters behind the FileStats of one file, bumped without a lock
+ */
+struct FileCounters {
+  std::atomic<std::uint64_t> hits;
+  std::atomic<std::uint64_t> misses;
+  std::atomic<std::uint64_t> diskreads;
+  std::atomic<std::uint64_t> diskwrites;
+  std::atomic<std::uint64_t> evictions;
+
+  FileCounters()
+      : hits(0), misses(0), diskreads(0), diskwrites(0), evictions(0) {}
+};
+
+/**
+ * @brief Class to maintain statistics of buffer usage
+ *
+ * Hits bump a StatCounter and the file's counter, a relaxed atomic
+ * increment found without a lock.  Everything else is counted on paths that go to disk or take
+ * the pool latch anyway.  Counters are read without
+ * stopping the buffer pool, so a snapshot taken under load is approximate.
+ */
+struct BufStats {
+  /**
+   * Number of reads of pages found in the buffer pool
+   */
+  StatCounter hits;
+
+  /**
+   * Number of reads of pages not in the buffer pool
+   */
+  StatCounter misses;
+
+  /**
+   * Number of pages allocated through the buffer pool
+   */
+  StatCounter allocs;
+
+  /**
+   * Number of pages read from disk (including allocs)
+   */
+  StatCounter diskreads;
+
+  /**
+   * Number of pages written back to disk
+   */
+  StatCounter diskwrites;
+
+  /**
+   * Number of pages taken out of the buffer pool, to make room, by
+   * flushFile() or by a shrinking resize()
+   */
+  StatCounter evictions;
+
+  /**
+   * Number of evictions that had to write the page back first
+   */
+  StatCounter dirtyEvictions;
+
+  /**
+   * Number of calls to flushFile()
+   */
+  StatCounter flushes;
+
+  /**
+   * Largest number of frames pinned at the same time
+   */
+  std::atomic<std::uint32_t> pinnedHighWater;
+
+  /**
+   * Time from a miss until the page is pinned in the buffer pool
+   */
+  LatencyHistogram missLatency;
+
+  /**
+   * Time taken by each write of one page or one run of pages to disk
+   */
+  LatencyHistogram writeLatency;
+
+  /**
+   * Total number of accesses to buffer pool
+   */
+  std::uint64_t accesses() const { return hits + misses + allocs; }
+
+  /**
+   * Raises pinnedHighWater to pinned if it is lower.
+   */
+  void notePinned(const std::uint32_t pinned) {
+    std::uint32_t high = pinnedHighWater.load(std::memory_order_relaxed);
+    while (pinned > high &&
+           !pinnedHighWater.compare_exchange_weak(high, pinned,
+                                                  std::memory_order_relaxed)) {
+    }
+  }
+
+  /**
+   * Adds n to a field of the statistics of the file.  Takes filesLatch only
+   * the first time this object sees the file; after that the counters are
+   * found through File::ownerSlot().
+   *
+   * @param file    File the pages belong to
+   * @param field   Field to add to, e.g. &FileCounters::diskreads
+   * @param n       Number to add
+   */
+  void addFile(const File* file,
+               std::atomic<std::uint64_t> FileCounters::*field,
+               const std::uint64_t n = 1);
+
+  /**
+   * Returns the statistics of every file seen so far, by file name.
+   */
+  std::map<std::string, FileStats> fileStats() const;
+
+  /**
+   * Returns all statistics as a JSON object.
+   */
+  std::string toJSON() const;
+
+  /**
+   * Clear all values
+   */
+  void clear();
+
+  /**
+   * Constructor of BufStats class
+   */
+  BufStats();
+
+  /**
+   * Destructor of BufStats class
+   */
+  ~BufStats();
+
+ private:
+  BufStats(const BufStats&);
+  BufStats& operator=(const BufStats&);
+
+  /**
+   * Returns the counters of the file, making them if the file is new, and
+   * remembers them on the file for the next addFile().
+   */
+  FileCounters* fileCounters(const File* file);
+
+  /**
+   * Owner id for File::ownerSlot(), unique among all BufStats ever made
+   */
+  const std::uint64_t id;
+
+  /**
+   * Counters per file name, protected by filesLatch.  Never freed before
+   * the destructor, since files may still point at them.
+   */
+  std::map<std::string, FileCounters*> files;
+  mutable std::mutex filesLatch;
+};
+
+}
@@ -17,41 +17,109 @@
  * other page operations
  */
 
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <future>
 #include <memory>
+#include <new>
 #include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
 #include "buffer.h"
 #include "exceptions/buffer_exceeded_exception.h"
 #include "exceptions/page_not_pinned_exception.h"
 #include "exceptions/page_pinned_exception.h"
 #include "exceptions/bad_buffer_exception.h"
-#include "exceptions/hash_not_found_exception.h"
 
 namespace badgerdb {
 
+/*
+ * First line of a resident-set snapshot, naming its format
+ */
+static const char WARMUP_MAGIC[] = "badgerdb resident set 1";
+
+/*
+ * Function Name: nanosSince
+ * Input: time_point
+ * Output: Nanoseconds elapsed since the time point
+ * Purpose: Measures latencies for the statistics
+ */
+static std::uint64_t nanosSince(const std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+/*
+ * Function Name: sharedIoEngine
+ * Input: None
+ * Output: The I/O engine shared by the pools of the process
+ * Purpose: Makes one engine, io_uring where the kernel allows it, for every
+ * pool that has not chosen its own with setIoEngine. It is never deleted,
+ * so pools torn down at exit can still use it.
+ */
+static const std::shared_ptr<IoEngine>& sharedIoEngine()
+{
+    static const std::shared_ptr<IoEngine>* const engine =
+        new std::shared_ptr<IoEngine>(IoEngine::create(IO_ENGINE_AUTO));
+    return *engine;
+}
+
 /*
  * Function Name: BufMgr
- * Input: uint32
+ * Input: uint32, ReplacementPolicyType, bool
+ * Output: BufMgr Object
+ * Purpose: Constructor for BufMgr class using one of the built-in
+ * replacement policies
+ */
+BufMgr::BufMgr(std::uint32_t bufs, ReplacementPolicyType type, bool prefault)
+	: BufMgr(bufs, ReplacementPolicy::create(type, checkFrames(bufs)), prefault) {
+}
+
+/*
+ * Function Name: BufMgr
+ * Input: uint32, ReplacementPolicy pointer, bool
  * Output: BufMgr Object
  * Purpose: Constructor for BufMgr class
  * Creates an array of BufDesc, an array of pages, a BufHashTable
- * and initializes a clockHand.
+ * and attaches the replacement policy to the BufDesc array.
  */
-BufMgr::BufMgr(std::uint32_t bufs)
-	: numBufs(bufs) {
-	bufDescTable = new BufDesc[bufs];
+BufMgr::BufMgr(std::uint32_t bufs, ReplacementPolicy* policy, bool prefault)
+	: numBufs(bufs), bufDescTable(64), policy(policy), pinnedFrames(0), writer(NULL),
+	  cleanLowWater(0), stopWriter(false), maxReadahead(0), prefetcher(NULL),
+	  stopPrefetcher(false), prefetching(NULL), warmer(NULL), stopWarmer(false),
+	  warming(NULL), bindings(NULL), bindingEpoch(0),
+	  bufPool(FRAME_ALIGNMENT, true, prefault) {
+  if (bufs > MAX_FRAMES) {
+    // The destructor does not run for a pool that fails to construct.
+    delete policy;
+    checkFrames(bufs);
+  }
+  // Frames are allocated in aligned chunks, so they can be handed to the
+  // kernel as they are and do not move when the pool is resized.  Each chunk
+  // of pages is one huge page where the kernel supports them.
+  bufDescTable.grow(bufs);
+  bufPool.grow(bufs);
 
   for (FrameId i = 0; i < bufs; i++)
   {
   	bufDescTable[i].frameNo = i;
   	bufDescTable[i].valid = false;
+  	freeFrames.push_back(i);
   }
 
-  bufPool = new Page[bufs];
-
 	int htsize = ((((int) (bufs * 1.2))*2)/2)+1;
-  hashTable = new BufHashTbl (htsize);  // allocate the buffer hash table
+  // allocate the buffer hash table, with room for the largest pool
+  hashTable = new BufHashTbl (htsize, FrameArray<Page>::MAX_FRAMES);
 
-  clockHand = bufs - 1;
+  policy->bufDescTable = &bufDescTable;
+  bindingReaders[0] = 0;
+  bindingReaders[1] = 0;
 }
 
 /*
@@ -59,96 +127,691 @@ BufMgr::BufMgr(std::uint32_t bufs)
  * Input: None
  * Output: None
  * Purpose: Destructor for BufMgr
- * Flushes out all dirty pages from the bufPool
- * then deallocates the buffer pool and the BufDesc Table
+ * Saves the resident set if asked to, flushes out all dirty pages from the
+ * bufPool then deallocates the buffer pool and the BufDesc Table
  */
 BufMgr::~BufMgr() {
-    for(unsigned int i = 0; i < numBufs; i++){
-        if(bufDescTable[i].dirty == true){
-            flushFile(bufDescTable[i].file);
+    stopReadahead();
+    stopBackgroundWriter();
+    stopWarmUp();
+    // Named pools flush their own files; then flush this pool's files here.
+    for(std::map<std::string, BufMgr*>::iterator it = pools.begin();
+        it != pools.end(); ++it){
+        delete it->second;
+    }
+    pools.clear();
+    delete bindings.exchange(NULL);
+    if(!shutdownSnapshot.empty()){
+        saveResidentSet(shutdownSnapshot);
+    }
+    // Flush every file with dirty pages once, rather than once per page.
+    std::vector<const File*> files;
+    for(std::map<const File*, std::vector<FrameId> >::const_iterator it =
+            residentFrames.begin(); it != residentFrames.end(); ++it){
+        for(std::size_t i = 0; i < it->second.size(); i++){
+            if(bufDescTable[it->second[i]].dirty == true){
+                files.push_back(it->first);
+                break;
+            }
         }
     }
-  //Deallocate bufDescTable, bufPool and hashTable
-    delete [] bufDescTable;
-    delete [] bufPool;
+    for(std::size_t i = 0; i < files.size(); i++){
+        flushFile(files[i]);
+    }
+    // Waits for any request still in flight on an engine of our own.
+    ioEngine.reset();
+  //Deallocate hashTable; bufDescTable and bufPool free themselves
     delete hashTable;
+    delete policy;
 }
 
 /*
- * Function Name: advanceClock
- * Input: None
+ * Function Name: pinResident
+ * Input: File pointer, constant PageID, FrameId reference and AccessHint
+ * Output: True if the page was found in the buffer pool
+ * Purpose: Looks the page up without latching the page table and pins it
+ * under the latch of its frame, which also waits out a write-back in
+ * progress. The page may have left the frame after the lookup; it is then
+ * looked up again under its page table latch and pinned there. A
+ * sequential-once read leaves the reference bit alone, so that a scan does
+ * not count as a reuse.
+ */
+bool BufMgr::pinResident(File* file, const PageId pageNo, FrameId& frame,
+                         const AccessHint hint)
+{
+    const bool reuse = hint != HINT_SEQUENTIAL_ONCE;
+    if(!hashTable->find(file, pageNo, frame)){
+        return false;
+    }
+    {
+        // Pages only leave a frame under its latch, and are marked invalid
+        // when they do.
+        BufDesc& desc = bufDescTable[frame];
+        std::lock_guard<std::mutex> guard(desc.latch);
+        if(desc.valid == true && desc.file == file && desc.pageNo == pageNo){
+            if(reuse){
+                desc.refbit = true;
+            }
+            pinFrame(frame);
+            return true;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> guard(hashTable->latch(file, pageNo));
+        if(!hashTable->find(file, pageNo, frame)){
+            return false;
+        }
+        if(reuse){
+            bufDescTable[frame].refbit = true;
+        }
+        pinFrame(frame);
+    }
+    std::lock_guard<std::mutex> wait(bufDescTable[frame].latch);
+    return true;
+}
+
+/*
+ * Function Name: evictFrame
+ * Input: FrameId
+ * Output: False if the frame turned out to be pinned
+ * Purpose: Writes the page of an unpinned frame back if it is dirty and
+ * removes it from the hashTable. The frame is pinned by us during the write
+ * so nobody else evicts it, and its latch makes readers that pin it in the
+ * meantime wait; if any did, the eviction is abandoned.
+ */
+bool BufMgr::evictFrame(const FrameId frame)
+{
+    BufDesc& desc = bufDescTable[frame];
+    File* file = desc.file;
+    const PageId pageNo = desc.pageNo;
+    std::mutex& partition = hashTable->latch(file, pageNo);
+    {
+        std::lock_guard<std::mutex> guard(partition);
+        if(desc.pinCnt != 0){
+            return false;
+        }
+        pinFrame(frame);
+    }
+
+    std::lock_guard<std::mutex> frameGuard(desc.latch);
+    const bool dirty = desc.dirty;
+    if(dirty){
+        try{
+            std::lock_guard<std::mutex> io(ioLatch);
+            const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            file->writePage(bufPool[frame]);
+            bufStats.writeLatency.record(nanosSince(start));
+        }catch(...){
+            unpinFrame(frame);
+            throw;
+        }
+        desc.dirty = false;
+        bufStats.diskwrites.add();
+        bufStats.addFile(file, &FileCounters::diskwrites);
+    }
+
+    std::lock_guard<std::mutex> guard(partition);
+    if(desc.pinCnt != 1){
+        unpinFrame(frame);
+        return false;
+    }
+    hashTable->remove(file, pageNo);
+    unpinFrame(frame);
+    // Readers that found the frame before the page was removed must not pin it.
+    unlinkResident(frame);
+    desc.valid = false;
+    bufStats.evictions.add();
+    if(dirty){
+        bufStats.dirtyEvictions.add();
+    }
+    bufStats.addFile(file, &FileCounters::evictions);
+    return true;
+}
+
+/*
+ * Function Name: pinFrame
+ * Input: FrameId
+ * Output: None
+ * Purpose: Increments the pin count and counts the frame as pinned if it
+ * was not before
+ */
+void BufMgr::pinFrame(const FrameId frame)
+{
+    if(bufDescTable[frame].pinCnt++ == 0){
+        bufStats.notePinned(++pinnedFrames);
+    }
+}
+
+/*
+ * Function Name: unpinFrame
+ * Input: FrameId
+ * Output: True if the frame is no longer pinned
+ * Purpose: Decrements the pin count and stops counting the frame as pinned
+ * when it drops to zero
+ */
+bool BufMgr::unpinFrame(const FrameId frame)
+{
+    if(--bufDescTable[frame].pinCnt == 0){
+        pinnedFrames--;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Function Name: freeFrame
+ * Input: FrameId
+ * Output: None
+ * Purpose: Clears the frame, dropping any pins left on it, and returns it to
+ * the free list
+ */
+void BufMgr::freeFrame(const FrameId frame)
+{
+    if(bufDescTable[frame].pinCnt.exchange(0) != 0){
+        pinnedFrames--;
+    }
+    if(bufDescTable[frame].valid == true){
+        unlinkResident(frame);
+    }
+    bufDescTable[frame].Clear();
+    freeFrames.push_back(frame);
+}
+
+/*
+ * Function Name: linkResident
+ * Input: FrameId
+ * Output: None
+ * Purpose: Appends the frame to the resident frames of the file whose page
+ * it now holds
+ */
+void BufMgr::linkResident(const FrameId frame)
+{
+    std::vector<FrameId>& frames = residentFrames[bufDescTable[frame].file];
+    bufDescTable[frame].fileSlot = frames.size();
+    frames.push_back(frame);
+}
+
+/*
+ * Function Name: unlinkResident
+ * Input: FrameId
  * Output: None
- * Purpose: Advance clock to next frame in the buffer pool
- * Uses modular math to logically make it like a clockHand
+ * Purpose: Removes the frame from the resident frames of its file by moving
+ * the last of them into its place, and forgets the file when no frame is left
  */
-void BufMgr::advanceClock()
+void BufMgr::unlinkResident(const FrameId frame)
 {
-    clockHand = (clockHand+1) % numBufs;
+    std::map<const File*, std::vector<FrameId> >::iterator it =
+        residentFrames.find(bufDescTable[frame].file);
+    std::vector<FrameId>& frames = it->second;
+    const FrameId last = frames.back();
+    frames[bufDescTable[frame].fileSlot] = last;
+    bufDescTable[last].fileSlot = bufDescTable[frame].fileSlot;
+    frames.pop_back();
+    if(frames.empty()){
+        residentFrames.erase(it);
+    }
 }
 
 /*
  * Function Name: allocBuf
- * Input: FrameId reference
+ * Input: FrameId reference, File pointer and page number
  * Output: None
- * Purpose: Allocates a freem frame using the clock algorithm
+ * Purpose: Allocates a free frame for the given page. Frames on the free list
+ * are used first; otherwise the replacement policy picks a frame, whose page
+ * is written back when dirty and removed from the hashTable. The frame is
+ * returned pinned once.
  */
-void BufMgr::allocBuf(FrameId & frame)
+void BufMgr::allocBuf(FrameId & frame, const File* file, const PageId pageNo)
 {
- bool findNext = false;
-    unsigned int pinned = 0;
-    //
-    while(!findNext){
-        advanceClock();
-        if(pinned == numBufs){
+    while(!freeFrames.empty()){
+        frame = freeFrames.front();
+        freeFrames.pop_front();
+        if(bufDescTable[frame].valid == false && bufDescTable[frame].pinCnt == 0){
+            pinFrame(frame);
+            return;
+        }
+    }
+    for(;;){
+        // Every frame holds a page; fail at once if none of them is unpinned.
+        if(pinnedFrames == numBufs || !policy->chooseVictim(frame, file, pageNo)){
             throw BufferExceededException();
         }
-        if (bufDescTable[clockHand].valid == false){
-            bufDescTable[clockHand].Clear();
-            frame = clockHand;
-            findNext = true;
+        if(bufDescTable[frame].valid == true){
+            if(bufDescTable[frame].dirty == true && writer != NULL){
+                // The writer fell behind; let it catch up for the next miss.
+                writerWake.notify_one();
+            }
+            if(!evictFrame(frame)){
+                // A reader pinned the page while it was written back.
+                continue;
+            }
+            policy->onEvict(frame);
         }
-        else if(bufDescTable[clockHand].pinCnt > 0){
-            pinned++;
+        bufDescTable[frame].Clear();
+        pinFrame(frame);
+        return;
+    }
+}
+
+/*
+ * Function Name: allocRingBuf
+ * Input: BufferRing pointer, FrameId reference, File pointer and page number
+ * Output: None
+ * Purpose: Allocates a frame for the given page from the ring. The frame of
+ * the next slot is recycled if the ring's page is still in it and unpinned;
+ * otherwise allocBuf picks a frame, which takes over the slot.
+ */
+void BufMgr::allocRingBuf(BufferRing* ring, FrameId& frame, File* file,
+                          const PageId pageNo)
+{
+    const std::uint32_t slot = ring->next;
+    ring->next = (ring->next + 1) % ring->size();
+
+    const PageKey& owned = ring->pages[slot];
+    if(owned.file != NULL){
+        const FrameId candidate = ring->frames[slot];
+        BufDesc& desc = bufDescTable[candidate];
+        if(desc.valid == true && desc.file == owned.file &&
+           desc.pageNo == owned.pageNo && desc.pinCnt == 0 &&
+           evictFrame(candidate)){
+            policy->onEvict(candidate);
+            desc.Clear();
+            pinFrame(candidate);
+            frame = candidate;
+            ring->pages[slot].file = file;
+            ring->pages[slot].pageNo = pageNo;
+            return;
+        }
+    }
+    allocBuf(frame, file, pageNo);
+    ring->frames[slot] = frame;
+    ring->pages[slot].file = file;
+    ring->pages[slot].pageNo = pageNo;
+}
+
+/*
+ * Function Name: releaseFrame
+ * Input: FrameId
+ * Output: None
+ * Purpose: Hands a frame reserved by allocBuf back to the replacement policy
+ * without ever having installed a page in it
+ */
+void BufMgr::releaseFrame(const FrameId frame)
+{
+    std::lock_guard<std::mutex> pool(poolLatch);
+    freeFrame(frame);
+    policy->onDispose(frame);
+}
+
+/*
+ * Function Name: readFrame
+ * Input: File pointer, constant PageID and BufferRing pointer
+ * Output: Frame holding the page
+ * Purpose: Read a page from disk into the buffer pool
+ * or set appropriate ref bit and increment pinCnt
+ */
+FrameId BufMgr::readFrame(File* file, const PageId pageNo, BufferRing* ring,
+                          const AccessHint hint)
+{
+    FrameId frame;
+    bool loaded = false;
+    if(pinResident(file, pageNo, frame, hint)){
+        bufStats.hits.add();
+        bufStats.addFile(file, &FileCounters::hits);
+    }else{
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bufStats.misses.add();
+        bufStats.addFile(file, &FileCounters::misses);
+        {
+            std::lock_guard<std::mutex> pool(poolLatch);
+            if(ring != NULL){
+                allocRingBuf(ring, frame, file, pageNo);
+            }else{
+                allocBuf(frame, file, pageNo);
+            }
         }
-        else if(bufDescTable[clockHand].refbit == true){
-            bufDescTable[clockHand].refbit = false;
+        //printf("This is frame#: %id\n", frame);
+        try{
+            file->readPage(pageNo, bufPool[frame]);
+        }catch(...){
+            // Hand the unused frame back before reporting the bad page.
+            releaseFrame(frame);
+            throw;
         }
-        else if(bufDescTable[clockHand].refbit == false){
-            if(bufDescTable[clockHand].dirty == true){
-                bufDescTable[clockHand].file->writePage(bufPool[clockHand]);
+        bufStats.diskreads.add();
+        bufStats.addFile(file, &FileCounters::diskreads);
+        frame = installFrame(file, pageNo, frame, ring, hint, loaded);
+        bufStats.missLatency.record(nanosSince(start));
+    }
+    finishRead(frame, loaded, hint);
+    if(maxReadahead != 0){
+        noteAccess(file, pageNo, bufPool[frame].next_page_number());
+    }
+    return frame;
+}
+
+/*
+ * Function Name: installFrame
+ * Input: File pointer, constant PageID, frame the page was read into,
+ * BufferRing pointer, AccessHint and bool reference
+ * Output: Frame holding the page
+ * Purpose: Enters a page just read into a frame reserved by allocBuf into
+ * the hashTable. If another thread read the same page in the meantime, pins
+ * its frame instead, waits until that frame is loaded and frees the reserved
+ * one; loaded tells which happened.
+ */
+FrameId BufMgr::installFrame(File* file, const PageId pageNo, FrameId frame,
+                             BufferRing* ring, const AccessHint hint,
+                             bool& loaded)
+{
+        loaded = false;
+        FrameId existing;
+        {
+            std::lock_guard<std::mutex> pool(poolLatch);
+            {
+                std::lock_guard<std::mutex> guard(hashTable->latch(file, pageNo));
+                if(hashTable->find(file, pageNo, existing)){
+                    bufDescTable[existing].refbit = true;
+                    pinFrame(existing);
+                }else{
+                    hashTable->insert(file, pageNo, frame);
+                    bufDescTable[frame].Set(file, pageNo);
+                    linkResident(frame);
+                    if(ring != NULL || hint == HINT_SEQUENTIAL_ONCE){
+                        // Scanned pages are not hot; let clock pass them by.
+                        bufDescTable[frame].refbit = false;
+                    }
+                    if(hint != HINT_NORMAL){
+                        bufDescTable[frame].hint = hint;
+                    }
+                    policy->onLoad(frame, file, pageNo);
+                    loaded = true;
+                }
             }
-            hashTable->remove(bufDescTable[clockHand].file, bufDescTable[clockHand].pageNo);
-            bufDescTable[clockHand].Clear();
-            frame = clockHand;
-            findNext = true;
+            if(!loaded){
+                // Another thread read the same page in the meantime; use its frame.
+                freeFrame(frame);
+                policy->onDispose(frame);
+            }
+        }
+        if(!loaded){
+            frame = existing;
+            std::lock_guard<std::mutex> wait(bufDescTable[frame].latch);
+        }
+        return frame;
+}
+
+/*
+ * Function Name: finishRead
+ * Input: FrameId, bool and AccessHint
+ * Output: None
+ * Purpose: Applies the hint of a read to the pinned frame and, unless the
+ * read loaded the page, tells the replacement policy about the hit. A
+ * sequential-once hit marks the frame so that noteUnpinned queues it for
+ * early replacement, unless the page is kept hot.
+ */
+void BufMgr::finishRead(const FrameId frame, const bool loaded,
+                        const AccessHint hint)
+{
+    if(!loaded && hint == HINT_SEQUENTIAL_ONCE){
+        AccessHint current = HINT_NORMAL;
+        bufDescTable[frame].hint.compare_exchange_strong(current, hint);
+    }else if(!loaded && hint != HINT_NORMAL){
+        bufDescTable[frame].hint = hint;
+    }
+    // A scan passing over a resident page does not make it any hotter.
+    if(!loaded && hint != HINT_SEQUENTIAL_ONCE && policy->needsAccessHooks()){
+        std::lock_guard<std::mutex> pool(poolLatch);
+        policy->onHit(frame);
+    }
+}
+
+/*
+ * A miss of readPageAsync whose read is in flight. Owned by the deferred
+ * future handed to the caller; if the future is dropped unread, waits for
+ * the read and hands the frame back.
+ */
+struct BufMgr::PendingRead {
+    BufMgr* bufMgr;
+    File* file;
+    PageId pageNo;
+    FrameId frame;
+    AccessHint hint;
+    std::chrono::steady_clock::time_point start;
+    std::shared_future<void> io;
+    bool finished;
+
+    ~PendingRead() {
+        if(!finished){
+            io.wait();
+            bufMgr->releaseFrame(frame);
+        }
+    }
+
+    PageHandle finish() {
+        finished = true;
+        try{
+            io.get();
+        }catch(...){
+            bufMgr->releaseFrame(frame);
+            throw;
         }
+        bufMgr->bufStats.diskreads.add();
+        bufMgr->bufStats.addFile(file, &FileCounters::diskreads);
+        bool loaded;
+        const FrameId used = bufMgr->installFrame(file, pageNo, frame, NULL, hint, loaded);
+        bufMgr->bufStats.missLatency.record(nanosSince(start));
+        bufMgr->finishRead(used, loaded, hint);
+        return PageHandle(bufMgr, file, pageNo, used, &bufMgr->bufPool[used]);
+    }
+};
+
+/*
+ * Function Name: readPageAsync
+ * Input: File pointer, constant PageID and AccessHint
+ * Output: Future of a handle on the page
+ * Purpose: Pins a resident page at once; on a miss reserves a frame,
+ * submits the read to the I/O engine and returns a deferred future that
+ * installs the page when the caller gets it
+ */
+std::future<PageHandle> BufMgr::readPageAsync(File* file, const PageId pageNo,
+                                              AccessHint hint)
+{
+    BufMgr* target = route(file);
+    if(target != this){
+        return target->readPageAsync(file, pageNo, hint);
+    }
+    std::promise<PageHandle> ready;
+    FrameId frame;
+    if(pinResident(file, pageNo, frame, hint)){
+        bufStats.hits.add();
+        bufStats.addFile(file, &FileCounters::hits);
+        finishRead(frame, false, hint);
+        ready.set_value(PageHandle(this, file, pageNo, frame, &bufPool[frame]));
+        return ready.get_future();
+    }
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bufStats.misses.add();
+    bufStats.addFile(file, &FileCounters::misses);
+    try{
+        std::lock_guard<std::mutex> pool(poolLatch);
+        allocBuf(frame, file, pageNo);
+    }catch(...){
+        ready.set_exception(std::current_exception());
+        return ready.get_future();
+    }
+    std::shared_ptr<std::promise<void> > io(new std::promise<void>());
+    std::shared_ptr<PendingRead> pending(new PendingRead());
+    pending->bufMgr = this;
+    pending->file = file;
+    pending->pageNo = pageNo;
+    pending->frame = frame;
+    pending->hint = hint;
+    pending->start = start;
+    pending->io = io->get_future().share();
+    pending->finished = false;
+    try{
+        // Keeps the engine alive until the request is submitted.
+        const std::shared_ptr<IoEngine> async = engine();
+        file->readPageAsync(*async, pageNo, bufPool[frame],
+                            [io](std::exception_ptr error){
+            // Runs on an engine thread, which must not block on latches.
+            if(error){
+                io->set_exception(error);
+            }else{
+                io->set_value();
+            }
+        });
+    }catch(...){
+        io->set_exception(std::current_exception());
+    }
+    return std::async(std::launch::deferred, [pending](){
+        return pending->finish();
+    });
+}
+
+/*
+ * Function Name: engine
+ * Input: None
+ * Output: The I/O engine
+ * Purpose: Returns the engine for asynchronous I/O: the one chosen with
+ * setIoEngine, or the one shared by the process. Callers hold on to the
+ * pointer while they submit, so setIoEngine cannot destroy it under them.
+ */
+std::shared_ptr<IoEngine> BufMgr::engine()
+{
+    std::lock_guard<std::mutex> guard(ioEngineLatch);
+    if(!ioEngine){
+        return sharedIoEngine();
     }
+    return ioEngine;
+}
+
+/*
+ * Function Name: setIoEngine
+ * Input: IoEngineType
+ * Output: False if the kernel does not support the type
+ * Purpose: Replaces the I/O engine. The old one is destroyed, after
+ * finishing its requests, once no submitter holds it any more.
+ */
+bool BufMgr::setIoEngine(const IoEngineType type)
+{
+    std::shared_ptr<IoEngine> replacement(IoEngine::create(type));
+    if(!replacement){
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> guard(ioEngineLatch);
+        ioEngine.swap(replacement);
+    }
+    // The old engine, if this was its last holder, waits here for its
+    // requests rather than under ioEngineLatch.
+    replacement.reset();
+    return true;
+}
+
+/*
+ * Function Name: ioEngineName
+ * Input: None
+ * Output: Name of the I/O engine
+ * Purpose: Tells which engine asynchronous I/O runs on
+ */
+const char* BufMgr::ioEngineName()
+{
+    return engine()->name();
 }
 
 /*
  * Function Name: readPage
- * Input: File pointer, constant PageID and reference to a Page
+ * Input: File pointer, constant PageID, reference to a Page pointer and
+ * BufferRing pointer
  * Output: None
- * Purpose: Read a page from disk into the buffer pool
- * or set appropriate ref bit and increment pinCnt
+ * Purpose: Reads the page into the buffer pool and returns the frame's page
  */
-void BufMgr::readPage(File* file, const PageId pageNo, Page*& page)
+void BufMgr::readPage(File* file, const PageId pageNo, Page*& page,
+                      BufferRing* ring, AccessHint hint)
 {
-  FrameId frame;
-    try{
-        hashTable->lookup(file, pageNo, frame);
-        bufDescTable[frame].refbit = true;
-        bufDescTable[frame].pinCnt++;
-        page = &bufPool[frame];
-
-    }catch(HashNotFoundException e){
-        FrameId frame;
-        allocBuf(frame);
-        //printf("This is frame#: %id\n", frame);
-        bufPool[frame] = file->readPage(pageNo);
-        hashTable->insert(file, pageNo, frame);
-        bufDescTable[frame].Set(file, pageNo);
-        page = &bufPool[frame];
+    BufMgr* target = route(file);
+    if(target != this){
+        target->readPage(file, pageNo, page, NULL, hint);
+        return;
+    }
+    page = &bufPool[readFrame(file, pageNo, ring, hint)];
+}
+
+/*
+ * Function Name: readPage
+ * Input: File pointer, constant PageID and BufferRing pointer
+ * Output: PageHandle
+ * Purpose: Reads the page like readPage above and wraps the pin in a handle
+ */
+PageHandle BufMgr::readPage(File* file, const PageId pageNo, BufferRing* ring,
+                            AccessHint hint)
+{
+    BufMgr* target = route(file);
+    if(target != this){
+        return target->readPage(file, pageNo, NULL, hint);
+    }
+    const FrameId frame = readFrame(file, pageNo, ring, hint);
+    return PageHandle(this, file, pageNo, frame, &bufPool[frame]);
+}
+
+/*
+ * Function Name: releasePin
+ * Input: FrameId, File pointer, constant PageID and constant bool
+ * Output: None
+ * Purpose: Unpins the page in the given frame without looking it up in the
+ * hashTable, and sets the dirty bit
+ */
+void BufMgr::releasePin(const FrameId frame, File* file, const PageId pageNo,
+                        const bool dirty, const AccessHint hint)
+{
+    BufDesc& desc = bufDescTable[frame];
+    bool unpinned;
+    {
+        std::lock_guard<std::mutex> guard(hashTable->latch(file, pageNo));
+        if(desc.valid == false || desc.file != file || desc.pageNo != pageNo){
+            // The page was disposed of while pinned.
+            return;
+        }
+        if(desc.pinCnt == 0){
+            throw PageNotPinnedException(file->filename(), pageNo, frame);
+        }
+        if(dirty == true){
+            desc.dirty = true;
+        }
+        if(hint != HINT_NORMAL){
+            desc.hint = hint;
+        }
+        unpinned = unpinFrame(frame);
+    }
+    if(unpinned){
+        noteUnpinned(frame);
+    }
+}
+
+/*
+ * Function Name: noteUnpinned
+ * Input: FrameId
+ * Output: None
+ * Purpose: Reports a frame whose last pin was released to the replacement
+ * policy, queueing it as the next victim for an evict-next hint and behind
+ * those for a sequential-once hint
+ */
+void BufMgr::noteUnpinned(const FrameId frame)
+{
+    const AccessHint hint = bufDescTable[frame].hint;
+    const bool early = hint == HINT_EVICT_NEXT || hint == HINT_SEQUENTIAL_ONCE;
+    if(!early && !policy->needsAccessHooks()){
+        return;
+    }
+    std::lock_guard<std::mutex> pool(poolLatch);
+    if(policy->needsAccessHooks()){
+        policy->onUnpin(frame);
+    }
+    if(early){
+        policy->queueVictim(frame, hint == HINT_EVICT_NEXT);
     }
 }
 
@@ -158,22 +821,38 @@ void BufMgr::readPage(File* file, const PageId pageNo, Page*& page)
  i* Output: None
  * Purpose: Decrement pinCnt of of the input and set the dirty bit
  */
-void BufMgr::unPinPage(File* file, const PageId pageNo, const bool dirty)
+void BufMgr::unPinPage(File* file, const PageId pageNo, const bool dirty,
+                       AccessHint hint)
 {
+  BufMgr* target = route(file);
+  if(target != this){
+      target->unPinPage(file, pageNo, dirty, hint);
+      return;
+  }
   FrameId frame;
-    try{
-        hashTable->lookup(file, pageNo, frame);
+    bool unpinned = false;
+    {
+        std::lock_guard<std::mutex> guard(hashTable->latch(file, pageNo));
+        if(!hashTable->find(file, pageNo, frame)){
+            return;
+        }
         if(bufDescTable[frame].pinCnt > 0){
-            bufDescTable[frame].pinCnt--;
+            // Mark dirty before the pin is released, so an evicting thread
+            // never sees the page unpinned but clean.
             if (dirty == true){
                 bufDescTable[frame].dirty = dirty;
             }
+            if(hint != HINT_NORMAL){
+                bufDescTable[frame].hint = hint;
+            }
+            unpinned = unpinFrame(frame);
         }
         else{
             throw PageNotPinnedException("Ping 本來就是 0", pageNo, frame);
         }
-    }catch(HashNotFoundException e){
-
+    }
+    if(unpinned){
+        noteUnpinned(frame);
     }
 }
 
@@ -182,85 +861,1407 @@ void BufMgr::unPinPage(File* file, const PageId pageNo, const bool dirty)
  * Input: File pointer
  * Output: None
  * Purpose:Flushes all pages belonging to the file, remove the pages from the
- * hashTable and clear the corresponding bufDescs
+ * hashTable and clear the corresponding bufDescs. The file's frames come
+ * from residentFrames, so the cost follows the file's pages in the pool
+ * rather than the pool size. Finally syncs the file, so that every write
+ * to it so far is durable.
  */
 void BufMgr::flushFile(const File* file)
 {
-  for(unsigned int i = 0; i < numBufs; i++){
-        if(bufDescTable[i].file == file){//是他文件中的PAGE
-            if(bufDescTable[i].pinCnt != 0){
-                throw PagePinnedException("This removing page is already being used", bufDescTable[i].pageNo, bufDescTable[i].frameNo);
-            }
-            if(bufDescTable[i].valid == false){
-                throw BadBufferException(bufDescTable[i].frameNo, bufDescTable[i].dirty, false, bufDescTable[i].refbit);
-            }
-            if(bufDescTable[i].dirty == true){
-                bufDescTable[i].file->writePage(bufPool[i]);
-                bufDescTable[i].dirty = false;
-            }
-            hashTable->remove(file, bufPool[i].page_number());
-            bufDescTable[i].Clear();
-        }
+  BufMgr* target = route(file);
+  if(target != this){
+      target->flushFile(file);
+      return;
   }
+  flushResident(file);
 }
 
 /*
- * Function Name: allocPage
- * Input: File pointer, page number and reference to a page
+ * Function Name: flushResident
+ * Input: File pointer
  * Output: None
- * Purpose: Allocates an empty page and returns both the page number of
- *          the newly allocated page to the caller via the pageNo param
- *          and a pointer to the buffer frame allocated for the page via
- *          page param
+ * Purpose: Writes back and evicts the file's pages in this pool without
+ * routing the file, then syncs it
  */
-
-// InvalidRecordException thrown during main
-void BufMgr::allocPage(File* file, PageId &pageNo, Page*& page)
+void BufMgr::flushResident(const File* file)
 {
-    FrameId frame;
-    Page new_page = file->allocatePage();
-    allocBuf(frame);
-    hashTable->insert(file,new_page.page_number(), frame);
-    bufDescTable[frame].Set(file, new_page.page_number());
-    pageNo = new_page.page_number();
-    bufPool[frame] = new_page; //?????????????????????
-    page = &bufPool[frame];
+  bufStats.flushes.add();
+  cancelReadahead(file);
+  {
+    std::lock_guard<std::mutex> pool(poolLatch);
+    evictFile(file);
+  }
+  // Sync without the pool latch, as the disk may take a while.
+  file->sync();
 }
 
 /*
- * Function Name: disposePage
- * Input: File pointer and page number
+ * Function Name: checkpoint
+ * Input: None
  * Output: None
- * Purpose: Deletes a page from file.
- * If the page is in the buffer, clear page from buffer and remove
- * from hashTable
+ * Purpose: Writes back the dirty pages of every resident file in file order
+ * without evicting them, then syncs each file. Only the lists of pages are
+ * taken under poolLatch; the writes run without it.
  */
-void BufMgr::disposePage(File* file, const PageId PageNo)
+void BufMgr::checkpoint()
 {
-    FrameId frame;
-    try{
-        hashTable->lookup(file, PageNo, frame);
-        bufDescTable[frame].Clear();
-        file->deletePage(PageNo);
-        hashTable->remove(file, PageNo);
-    }catch(HashNotFoundException e){
-        file->deletePage(PageNo);
+  {
+    std::lock_guard<std::mutex> guard(poolsLatch);
+    for(std::map<std::string, BufMgr*>::iterator it = pools.begin();
+        it != pools.end(); ++it){
+        it->second->checkpoint();
+    }
+  }
+  std::vector<File*> files;
+  std::vector<std::vector<PageId> > pageNos;
+  {
+    std::lock_guard<std::mutex> pool(poolLatch);
+    for(std::map<const File*, std::vector<FrameId> >::const_iterator it =
+            residentFrames.begin(); it != residentFrames.end(); ++it){
+        files.push_back(bufDescTable[it->second[0]].file);
+        pageNos.push_back(residentPages(it->second));
     }
+  }
+  for(std::size_t i = 0; i < files.size(); i++){
+      writeBackRuns(files[i], pageNos[i]);
+      files[i]->sync();
+  }
 }
 
 /*
- * Function Name: printSelf
- * Input: void
- * Output: void
- * Purpose: Prints out the total number of valid frames in bufDescTable
- * Iterates through bufDescTable and counts the number of frames whose valid
- * bit is set to true. Then it prints that counted value.
+ * Function Name: evictFile
+ * Input: File pointer
+ * Output: None
+ * Purpose: Writes back and evicts every page of the file in the buffer
+ * pool. Called with poolLatch held.
  */
-void BufMgr::printSelf(void)
+void BufMgr::evictFile(const File* file)
 {
-  BufDesc* tmpbuf;
-	int validFrames = 0;
-
+  std::map<const File*, std::vector<FrameId> >::const_iterator resident =
+      residentFrames.find(file);
+  if(resident == residentFrames.end()){
+      return;
+  }
+  // A copy, as evicting the pages empties the file's list.
+  std::vector<FrameId> frames(resident->second);
+  for(std::size_t j = 0; j < frames.size(); j++){
+        const FrameId i = frames[j];
+        waitForWriteBack(i);
+        if(bufDescTable[i].pinCnt != 0){
+            throw PagePinnedException("This removing page is already being used", bufDescTable[i].pageNo, bufDescTable[i].frameNo);
+        }
+        if(bufDescTable[i].valid == false){
+            throw BadBufferException(bufDescTable[i].frameNo, bufDescTable[i].dirty, false, bufDescTable[i].refbit);
+        }
+  }
+  // Write the pages back in file order, so the disk sees runs, not seeks.
+  writeBackRuns(bufDescTable[frames[0]].file, residentPages(frames));
+  for(std::size_t i = 0; i < frames.size(); i++){
+        // Pages dirtied since their run was written are written here alone.
+        const FrameId frame = frames[i];
+        if(!evictFrame(frame)){
+            throw PagePinnedException("This removing page is already being used", bufDescTable[frame].pageNo, bufDescTable[frame].frameNo);
+        }
+        policy->onEvict(frame);
+        freeFrame(frame);
+  }
+}
+
+/*
+ * Function Name: residentPages
+ * Input: Frames holding pages of one file
+ * Output: Page numbers of the frames, sorted
+ * Purpose: Lists the pages to write back in file order. Called with
+ * poolLatch held.
+ */
+std::vector<PageId> BufMgr::residentPages(const std::vector<FrameId>& frames) const
+{
+    std::vector<PageId> pageNos;
+    pageNos.reserve(frames.size());
+    for(std::size_t i = 0; i < frames.size(); i++){
+        pageNos.push_back(bufDescTable[frames[i]].pageNo);
+    }
+    std::sort(pageNos.begin(), pageNos.end());
+    return pageNos;
+}
+
+/*
+ * Function Name: writeBackRuns
+ * Input: File pointer, page numbers in ascending order
+ * Output: None
+ * Purpose: Writes the dirty pages among the given ones back, gathering pages
+ * with consecutive numbers into runs. Each page is looked up again under
+ * its page table latch, so poolLatch is not needed: pages that left the
+ * pool meanwhile are skipped like clean or pinned ones. Each page of a run
+ * is pinned and its frame latched until the run is on disk, as in
+ * evictFrame, and runs are written in batches that pin at most a
+ * WRITEBACK_SHARE of the pool.
+ */
+void BufMgr::writeBackRuns(File* file, const std::vector<PageId>& pageNos)
+{
+    const std::size_t budget = std::max<std::uint32_t>(1, numBufs / WRITEBACK_SHARE);
+    std::exception_ptr failure;
+    std::size_t next = 0;
+    while(next < pageNos.size()){
+        std::vector<std::vector<FrameId> > runs;
+        std::vector<std::vector<const Page*> > pages;
+        std::size_t pinned = 0;
+        while(next < pageNos.size() && pinned < budget){
+            std::vector<FrameId> run;
+            std::vector<const Page*> runPages;
+            for(; next < pageNos.size() && pinned < budget; next++){
+                const PageId pageNo = pageNos[next];
+                if(!run.empty() && pageNo != bufDescTable[run.back()].pageNo + 1){
+                    break;
+                }
+                FrameId frame;
+                bool found = false;
+                {
+                    std::lock_guard<std::mutex> guard(hashTable->latch(file, pageNo));
+                    if(hashTable->find(file, pageNo, frame) &&
+                       bufDescTable[frame].dirty == true && bufDescTable[frame].pinCnt == 0){
+                        pinFrame(frame);
+                        found = true;
+                    }
+                }
+                if(!found){
+                    // A clean or pinned page ends the run; evictFrame deals with it.
+                    if(run.empty()){
+                        continue;
+                    }
+                    break;
+                }
+                // Pinned by us alone, so only readers briefly hold the latch.
+                bufDescTable[frame].latch.lock();
+                run.push_back(frame);
+                runPages.push_back(&bufPool[frame]);
+                pinned++;
+            }
+            if(!run.empty()){
+                runs.push_back(run);
+                pages.push_back(runPages);
+            }
+        }
+        if(runs.empty()){
+            continue;
+        }
+        try{
+            writeRuns(file, runs, pages);
+        }catch(...){
+            // Write the other batches all the same.
+            if(!failure){
+                failure = std::current_exception();
+            }
+        }
+    }
+    if(failure){
+        std::rethrow_exception(failure);
+    }
+}
+
+/*
+ * Function Name: writeRuns
+ * Input: File pointer, frames and pages of each run
+ * Output: None
+ * Purpose: Writes the runs pinned and latched by writeBackRuns. A single run
+ * is written right away with pwritev; several runs are submitted to the I/O
+ * engine as one batch, so the disk has them all in flight. Runs written are
+ * marked clean; all are unlatched and unpinned.
+ */
+void BufMgr::writeRuns(File* file, const std::vector<std::vector<FrameId> >& runs,
+                       const std::vector<std::vector<const Page*> >& pages)
+{
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<std::future<void> > written;
+    {
+        // Only the submission is serialized with other writers; waiting for
+        // the disk happens after ioLatch is released.
+        std::shared_ptr<IoEngine> async;
+        if(runs.size() > 1){
+            async = engine();
+        }
+        std::lock_guard<std::mutex> io(ioLatch);
+        for(std::size_t r = 0; r < runs.size(); r++){
+            std::shared_ptr<std::promise<void> > done(new std::promise<void>());
+            written.push_back(done->get_future());
+            try{
+                if(!async){
+                    // Nothing to overlap with; skip the trip through the engine.
+                    file->writePages(pages[r].data(), pages[r].size());
+                    done->set_value();
+                    continue;
+                }
+                file->writePagesAsync(*async, pages[r].data(), pages[r].size(),
+                                      [done](std::exception_ptr error){
+                    if(error){
+                        done->set_exception(error);
+                    }else{
+                        done->set_value();
+                    }
+                });
+            }catch(...){
+                done->set_exception(std::current_exception());
+            }
+        }
+    }
+    std::exception_ptr failure;
+    for(std::size_t r = 0; r < runs.size(); r++){
+        bool ok = true;
+        try{
+            written[r].get();
+        }catch(...){
+            // Leave the run dirty; eviction will retry and report the error.
+            if(!failure){
+                failure = std::current_exception();
+            }
+            ok = false;
+        }
+        if(ok){
+            bufStats.writeLatency.record(nanosSince(start));
+            bufStats.diskwrites.add(runs[r].size());
+            bufStats.addFile(file, &FileCounters::diskwrites, runs[r].size());
+        }
+        for(std::size_t i = 0; i < runs[r].size(); i++){
+            BufDesc& desc = bufDescTable[runs[r][i]];
+            if(ok){
+                desc.dirty = false;
+            }
+            desc.latch.unlock();
+            std::lock_guard<std::mutex> guard(hashTable->latch(file, desc.pageNo));
+            unpinFrame(runs[r][i]);
+        }
+    }
+    if(failure){
+        std::rethrow_exception(failure);
+    }
+}
+
+/*
+ * Function Name: allocFrame
+ * Input: File pointer, page number reference and BufferRing pointer
+ * Output: Frame holding the page
+ * Purpose: Allocates an empty page in a frame and returns the page number of
+ *          the newly allocated page to the caller via the pageNo param
+ */
+FrameId BufMgr::allocFrame(File* file, PageId &pageNo, BufferRing* ring)
+{
+    FrameId frame;
+    {
+        // The page number is not known until the page has been allocated.
+        std::lock_guard<std::mutex> pool(poolLatch);
+        if(ring != NULL){
+            allocRingBuf(ring, frame, file, Page::INVALID_NUMBER);
+        }else{
+            allocBuf(frame, file, Page::INVALID_NUMBER);
+        }
+    }
+    try{
+        // Build the new page right in the frame, before it becomes visible
+        // in the hashTable.
+        std::lock_guard<std::mutex> io(ioLatch);
+        file->allocatePage(bufPool[frame]);
+    }catch(...){
+        releaseFrame(frame);
+        throw;
+    }
+    bufStats.allocs.add();
+    bufStats.diskreads.add();
+    bufStats.addFile(file, &FileCounters::diskreads);
+    const PageId newPageNo = bufPool[frame].page_number();
+
+    std::lock_guard<std::mutex> pool(poolLatch);
+    if(ring != NULL){
+        // Record the page number in the slot allocRingBuf just used.
+        ring->pages[(ring->next + ring->size() - 1) % ring->size()].pageNo = newPageNo;
+    }
+    {
+        std::lock_guard<std::mutex> guard(hashTable->latch(file, newPageNo));
+        hashTable->insert(file, newPageNo, frame);
+        bufDescTable[frame].Set(file, newPageNo);
+        linkResident(frame);
+        if(ring != NULL){
+            bufDescTable[frame].refbit = false;
+        }
+    }
+    policy->onLoad(frame, file, newPageNo);
+    pageNo = newPageNo;
+    return frame;
+}
+
+/*
+ * Function Name: allocPage
+ * Input: File pointer, page number and reference to a page
+ * Output: None
+ * Purpose: Allocates an empty page and returns both the page number of
+ *          the newly allocated page to the caller via the pageNo param
+ *          and a pointer to the buffer frame allocated for the page via
+ *          page param
+ */
+
+// InvalidRecordException thrown during main
+void BufMgr::allocPage(File* file, PageId &pageNo, Page*& page,
+                       BufferRing* ring)
+{
+    BufMgr* target = route(file);
+    if(target != this){
+        target->allocPage(file, pageNo, page);
+        return;
+    }
+    page = &bufPool[allocFrame(file, pageNo, ring)];
+}
+
+/*
+ * Function Name: allocPage
+ * Input: File pointer and BufferRing pointer
+ * Output: PageHandle
+ * Purpose: Allocates a page like allocPage above and wraps the pin in a
+ * handle
+ */
+PageHandle BufMgr::allocPage(File* file, BufferRing* ring)
+{
+    BufMgr* target = route(file);
+    if(target != this){
+        return target->allocPage(file);
+    }
+    PageId pageNo;
+    const FrameId frame = allocFrame(file, pageNo, ring);
+    return PageHandle(this, file, pageNo, frame, &bufPool[frame]);
+}
+
+/*
+ * Function Name: disposePage
+ * Input: File pointer and page number
+ * Output: None
+ * Purpose: Deletes a page from file.
+ * If the page is in the buffer, clear page from buffer and remove
+ * from hashTable
+ */
+void BufMgr::disposePage(File* file, const PageId PageNo)
+{
+    BufMgr* target = route(file);
+    if(target != this){
+        target->disposePage(file, PageNo);
+        return;
+    }
+    FrameId frame;
+    bool resident = false;
+    cancelReadahead(file);
+    std::lock_guard<std::mutex> pool(poolLatch);
+    {
+        std::lock_guard<std::mutex> guard(hashTable->latch(file, PageNo));
+        resident = hashTable->find(file, PageNo, frame);
+    }
+    if(resident){
+        // The frame latch waits out a write-back and keeps readers that
+        // found the page without the page table latch from pinning it.
+        std::lock_guard<std::mutex> frameGuard(bufDescTable[frame].latch);
+        std::lock_guard<std::mutex> guard(hashTable->latch(file, PageNo));
+        hashTable->erase(file, PageNo);
+        policy->onDispose(frame);
+        freeFrame(frame);
+    }
+    std::lock_guard<std::mutex> io(ioLatch);
+    file->deletePage(PageNo);
+}
+
+/*
+ * Function Name: startBackgroundWriter
+ * Input: uint32
+ * Output: None
+ * Purpose: Starts the background writer thread keeping lowWater frames
+ * clean or free
+ */
+void BufMgr::startBackgroundWriter(std::uint32_t lowWater)
+{
+    std::lock_guard<std::mutex> guard(writerMutex);
+    cleanLowWater = std::min<std::uint32_t>(lowWater, numBufs);
+    if(writer == NULL){
+        stopWriter = false;
+        writer = new std::thread(&BufMgr::backgroundWriter, this);
+    }
+}
+
+/*
+ * Function Name: stopBackgroundWriter
+ * Input: None
+ * Output: None
+ * Purpose: Asks the background writer to exit and joins it
+ */
+void BufMgr::stopBackgroundWriter()
+{
+    {
+        std::lock_guard<std::mutex> guard(writerMutex);
+        if(writer == NULL){
+            return;
+        }
+        stopWriter = true;
+    }
+    writerWake.notify_one();
+    writer->join();
+    delete writer;
+    writer = NULL;
+}
+
+/*
+ * Function Name: backgroundWriter
+ * Input: None
+ * Output: None
+ * Purpose: Cleans frames ahead of the replacement policy every few
+ * milliseconds, or as soon as allocBuf had to evict a dirty page
+ */
+void BufMgr::backgroundWriter()
+{
+    std::unique_lock<std::mutex> guard(writerMutex);
+    while(!stopWriter){
+        guard.unlock();
+        cleanAhead();
+        guard.lock();
+        if(!stopWriter){
+            writerWake.wait_for(guard, std::chrono::milliseconds(10));
+        }
+    }
+}
+
+/*
+ * Function Name: cleanAhead
+ * Input: None
+ * Output: None
+ * Purpose: Counts the frames that can be reused without a write and cleans
+ * the next victims of the replacement policy until there are cleanLowWater
+ * of them
+ */
+void BufMgr::cleanAhead()
+{
+    std::vector<FrameId> candidates;
+    std::uint32_t clean = 0;
+    {
+        std::lock_guard<std::mutex> pool(poolLatch);
+        for(FrameId i = 0; i < numBufs; i++){
+            if(bufDescTable[i].pinCnt == 0 &&
+               (bufDescTable[i].valid == false || bufDescTable[i].dirty == false)){
+                clean++;
+            }
+        }
+        if(clean >= cleanLowWater){
+            return;
+        }
+        policy->victimOrder(candidates, numBufs);
+    }
+    for(std::size_t i = 0; i < candidates.size() && clean < cleanLowWater; i++){
+        if(cleanFrame(candidates[i])){
+            clean++;
+        }
+    }
+}
+
+/*
+ * Function Name: cleanFrame
+ * Input: FrameId
+ * Output: True if the page was written back
+ * Purpose: Writes a dirty, unpinned page back while keeping it resident.
+ * The frame is pinned and its latch held during the write, so it cannot be
+ * picked as a victim and readers that pin it wait for the write to finish.
+ */
+bool BufMgr::cleanFrame(const FrameId frame)
+{
+    BufDesc& desc = bufDescTable[frame];
+    File* file;
+    PageId pageNo;
+    {
+        std::lock_guard<std::mutex> pool(poolLatch);
+        if(desc.valid == false || desc.dirty == false){
+            return false;
+        }
+        file = desc.file;
+        pageNo = desc.pageNo;
+        {
+            std::lock_guard<std::mutex> guard(hashTable->latch(file, pageNo));
+            if(desc.pinCnt != 0){
+                return false;
+            }
+            pinFrame(frame);
+        }
+        // Only threads holding poolLatch take the latch of an unpinned frame.
+        desc.latch.lock();
+    }
+
+    bool written = true;
+    try{
+        std::lock_guard<std::mutex> io(ioLatch);
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        file->writePage(bufPool[frame]);
+        bufStats.writeLatency.record(nanosSince(start));
+        desc.dirty = false;
+    }catch(...){
+        // Leave the page dirty; eviction will retry and report the error.
+        written = false;
+    }
+    if(written){
+        bufStats.diskwrites.add();
+        bufStats.addFile(file, &FileCounters::diskwrites);
+    }
+    {
+        std::lock_guard<std::mutex> guard(hashTable->latch(file, pageNo));
+        unpinFrame(frame);
+    }
+    desc.latch.unlock();
+    return written;
+}
+
+/*
+ * Function Name: waitForWriteBack
+ * Input: FrameId
+ * Output: None
+ * Purpose: Blocks until the background writer has finished with the frame
+ */
+void BufMgr::waitForWriteBack(const FrameId frame)
+{
+    std::lock_guard<std::mutex> wait(bufDescTable[frame].latch);
+}
+
+/*
+ * Function Name: PageHandle
+ * Input: None
+ * Output: PageHandle Object
+ * Purpose: Constructs an empty handle
+ */
+PageHandle::PageHandle()
+	: bufMgr(NULL), file(NULL), pageNumber(Page::INVALID_NUMBER), frame(0),
+	  page(NULL), dirty(false) {
+}
+
+/*
+ * Function Name: PageHandle
+ * Input: BufMgr pointer, File pointer, page number, FrameId, Page pointer
+ * Output: PageHandle Object
+ * Purpose: Constructs a handle for a pin taken by the buffer manager
+ */
+PageHandle::PageHandle(BufMgr* bufMgr, File* file, const PageId pageNo,
+                       const FrameId frame, Page* page)
+	: bufMgr(bufMgr), file(file), pageNumber(pageNo), frame(frame),
+	  page(page), dirty(false) {
+}
+
+/*
+ * Function Name: PageHandle
+ * Input: PageHandle rvalue
+ * Output: PageHandle Object
+ * Purpose: Takes over the pin of the other handle
+ */
+PageHandle::PageHandle(PageHandle&& other)
+	: bufMgr(other.bufMgr), file(other.file), pageNumber(other.pageNumber),
+	  frame(other.frame), page(other.page), dirty(other.dirty) {
+    other.bufMgr = NULL;
+    other.page = NULL;
+}
+
+/*
+ * Function Name: operator=
+ * Input: PageHandle rvalue
+ * Output: This handle
+ * Purpose: Releases the pin held so far and takes over the other's
+ */
+PageHandle& PageHandle::operator=(PageHandle&& other)
+{
+    if(this != &other){
+        release();
+        bufMgr = other.bufMgr;
+        file = other.file;
+        pageNumber = other.pageNumber;
+        frame = other.frame;
+        page = other.page;
+        dirty = other.dirty;
+        other.bufMgr = NULL;
+        other.page = NULL;
+    }
+    return *this;
+}
+
+/*
+ * Function Name: release
+ * Input: AccessHint
+ * Output: None
+ * Purpose: Unpins the page with the given hint and empties the handle
+ */
+void PageHandle::release(AccessHint hint)
+{
+    if(bufMgr != NULL){
+        BufMgr* owner = bufMgr;
+        bufMgr = NULL;
+        page = NULL;
+        owner->releasePin(frame, file, pageNumber, dirty, hint);
+    }
+}
+
+/*
+ * Function Name: BufferRing
+ * Input: uint32
+ * Output: BufferRing Object
+ * Purpose: Constructor for BufferRing class; all slots start empty
+ */
+BufferRing::BufferRing(std::uint32_t slots)
+	: frames(slots), next(0) {
+    PageKey empty = {NULL, Page::INVALID_NUMBER};
+    pages.assign(slots, empty);
+}
+
+/*
+ * Function Name: openStrategy
+ * Input: AccessStrategyType
+ * Output: BufferRing pointer
+ * Purpose: Creates a ring for a bulk operation. Bulk loads get a larger
+ * ring than scans, since their frames are dirty and have to be written
+ * back before they can be recycled.
+ */
+BufferRing* BufMgr::openStrategy(AccessStrategyType type)
+{
+    std::uint32_t slots = type == STRATEGY_BULK_WRITE ? 32 : 16;
+    slots = std::min<std::uint32_t>(slots, numBufs / 8);
+    return new BufferRing(std::max<std::uint32_t>(slots, 1));
+}
+
+/*
+ * Function Name: closeStrategy
+ * Input: BufferRing pointer
+ * Output: None
+ * Purpose: Deletes the ring; its pages stay in the buffer pool
+ */
+void BufMgr::closeStrategy(BufferRing* ring)
+{
+    delete ring;
+}
+
+/*
+ * Function Name: startReadahead
+ * Input: uint32
+ * Output: None
+ * Purpose: Starts the prefetch thread reading up to maxPages pages ahead of
+ * sequential scans
+ */
+void BufMgr::startReadahead(std::uint32_t maxPages)
+{
+    std::lock_guard<std::mutex> guard(readaheadMutex);
+    if(maxPages == 0){
+        return;
+    }
+    maxReadahead = maxPages;
+    if(prefetcher == NULL){
+        stopPrefetcher = false;
+        prefetcher = new std::thread(&BufMgr::prefetchLoop, this);
+    }
+}
+
+/*
+ * Function Name: stopReadahead
+ * Input: None
+ * Output: None
+ * Purpose: Turns readahead off, drops all queued batches and joins the
+ * prefetch thread
+ */
+void BufMgr::stopReadahead()
+{
+    {
+        std::lock_guard<std::mutex> guard(readaheadMutex);
+        if(prefetcher == NULL){
+            return;
+        }
+        maxReadahead = 0;
+        stopPrefetcher = true;
+        readaheadQueue.clear();
+        streams.clear();
+    }
+    readaheadWake.notify_one();
+    prefetcher->join();
+    delete prefetcher;
+    prefetcher = NULL;
+}
+
+/*
+ * Function Name: createPool
+ * Input: Pool name, uint32 and ReplacementPolicyType
+ * Output: The pool of that name
+ * Purpose: Creates a named pool owned by this one, unless it exists
+ */
+BufMgr* BufMgr::createPool(const std::string& name, std::uint32_t bufs,
+                           ReplacementPolicyType type)
+{
+    std::lock_guard<std::mutex> guard(poolsLatch);
+    BufMgr*& pool = pools[name];
+    if(pool == NULL){
+        pool = new BufMgr(bufs, type);
+    }
+    return pool;
+}
+
+/*
+ * Function Name: getPool
+ * Input: Pool name
+ * Output: The pool of that name, or NULL
+ * Purpose: Finds a pool created by createPool
+ */
+BufMgr* BufMgr::getPool(const std::string& name)
+{
+    std::lock_guard<std::mutex> guard(poolsLatch);
+    std::map<std::string, BufMgr*>::const_iterator it = pools.find(name);
+    return it == pools.end() ? NULL : it->second;
+}
+
+/*
+ * Function Name: route
+ * Input: File pointer
+ * Output: Pool serving the file
+ * Purpose: Looks the file name up in the current bindings; with no file
+ * bound this is a single atomic load. Otherwise the lookup counts itself
+ * among the readers of the current epoch, so that setBinding does not free
+ * the map under it; if the epoch moved on before the count was seen, the
+ * count is moved to the new epoch.
+ */
+BufMgr* BufMgr::route(const File* file)
+{
+    if(bindings.load(std::memory_order_acquire) == NULL){
+        return this;
+    }
+    std::uint32_t epoch = bindingEpoch.load();
+    bindingReaders[epoch % 2]++;
+    while(bindingEpoch.load() != epoch){
+        bindingReaders[epoch % 2]--;
+        epoch = bindingEpoch.load();
+        bindingReaders[epoch % 2]++;
+    }
+    BufMgr* target = this;
+    const std::map<std::string, BufMgr*>* current = bindings.load();
+    if(current != NULL){
+        std::map<std::string, BufMgr*>::const_iterator it =
+            current->find(file->filename());
+        if(it != current->end()){
+            target = it->second;
+        }
+    }
+    bindingReaders[epoch % 2]--;
+    return target;
+}
+
+/*
+ * Function Name: setBinding
+ * Input: File name and BufMgr pointer
+ * Output: None
+ * Purpose: Publishes a copy of the bindings with the file name routed to
+ * the pool, or removed if pool is NULL. Then starts a new epoch and frees
+ * the old bindings once no lookup of the old epoch is left. Lookups of the
+ * new epoch see the new bindings; the lookups of the epoch before were
+ * waited for by the previous change, which poolsLatch orders before this.
+ */
+void BufMgr::setBinding(const std::string& filename, BufMgr* pool)
+{
+    const std::map<std::string, BufMgr*>* current = bindings.load();
+    std::map<std::string, BufMgr*>* next =
+        current == NULL ? new std::map<std::string, BufMgr*>()
+                        : new std::map<std::string, BufMgr*>(*current);
+    if(pool != NULL){
+        (*next)[filename] = pool;
+    }else{
+        next->erase(filename);
+    }
+    if(next->empty()){
+        delete next;
+        next = NULL;
+    }
+    bindings.store(next);
+    if(current != NULL){
+        const std::uint32_t old = bindingEpoch++ % 2;
+        while(bindingReaders[old] != 0){
+            std::this_thread::yield();
+        }
+        delete current;
+    }
+}
+
+/*
+ * Function Name: bindFile
+ * Input: File pointer and pool name
+ * Output: False if there is no such pool
+ * Purpose: Routes the file to the named pool, then flushes it from the pool
+ * that served it before. Routing first means no new read brings a page of
+ * the file into the old pool after the flush.
+ */
+bool BufMgr::bindFile(const File* file, const std::string& pool)
+{
+    std::lock_guard<std::mutex> guard(poolsLatch);
+    std::map<std::string, BufMgr*>::const_iterator it = pools.find(pool);
+    if(it == pools.end()){
+        return false;
+    }
+    BufMgr* old = route(file);
+    if(old != it->second){
+        moveFile(file, old, it->second);
+    }
+    return true;
+}
+
+/*
+ * Function Name: unbindFile
+ * Input: File pointer
+ * Output: None
+ * Purpose: Routes the file back to this pool, then flushes it from the
+ * pool it was bound to
+ */
+void BufMgr::unbindFile(const File* file)
+{
+    std::lock_guard<std::mutex> guard(poolsLatch);
+    BufMgr* old = route(file);
+    if(old != this){
+        moveFile(file, old, this);
+    }
+}
+
+/*
+ * Function Name: moveFile
+ * Input: File pointer and the BufMgr pointers of the old and the new pool
+ * Output: None
+ * Purpose: Routes the file to the new pool, then flushes it from the old
+ * one. If a page of the file is pinned in the old pool, the file is routed
+ * back there, so that its pins are still released where they are held.
+ */
+void BufMgr::moveFile(const File* file, BufMgr* from, BufMgr* to)
+{
+    setBinding(file->filename(), to == this ? NULL : to);
+    try{
+        from->flushResident(file);
+    }catch(...){
+        setBinding(file->filename(), from == this ? NULL : from);
+        throw;
+    }
+}
+
+/*
+ * Function Name: resize
+ * Input: uint32
+ * Output: Number of frames in the buffer pool afterwards
+ * Purpose: Adds frames to the free list, or drains frames from the end of
+ * the pool. Pins are usually short, so when a pinned frame is reached the
+ * pool latch is released for a moment and draining goes on afterwards, up
+ * to RESIZE_RETRIES times.
+ */
+std::uint32_t BufMgr::resize(std::uint32_t frames)
+{
+    if(frames == 0){
+        frames = 1;
+    }
+    checkFrames(frames);
+    for(int attempt = 0; ; attempt++){
+        {
+            std::lock_guard<std::mutex> pool(poolLatch);
+            const std::uint32_t oldFrames = numBufs;
+            if(frames >= oldFrames){
+                bufDescTable.grow(frames);
+                bufPool.grow(frames);
+                for(FrameId i = oldFrames; i < frames; i++){
+                    bufDescTable[i].frameNo = i;
+                    freeFrames.push_back(i);
+                }
+                policy->resize(frames);
+                numBufs = frames;
+                return frames;
+            }
+            if(drainFrames(frames) || attempt == RESIZE_RETRIES){
+                return numBufs;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+/*
+ * Function Name: checkFrames
+ * Input: uint32
+ * Output: The number of frames
+ * Purpose: Rejects pool sizes beyond what the frame arrays can hold, before
+ * any frame is allocated
+ */
+std::uint32_t BufMgr::checkFrames(const std::uint32_t frames)
+{
+    if(frames > MAX_FRAMES){
+        std::ostringstream message;
+        message << "A buffer pool of " << frames << " frames exceeds the limit of "
+                << MAX_FRAMES << " frames";
+        throw std::invalid_argument(message.str());
+    }
+    return frames;
+}
+
+/*
+ * Function Name: drainFrames
+ * Input: uint32
+ * Output: True if the pool was shrunk to the given number of frames
+ * Purpose: Evicts the pages of the frames from the end of the pool, writing
+ * them back if dirty, until the pool has the given size or the next frame
+ * is pinned, and drops the frames drained
+ */
+bool BufMgr::drainFrames(const std::uint32_t frames)
+{
+    std::uint32_t kept = numBufs;
+    try{
+        while(kept > frames){
+            const FrameId frame = kept - 1;
+            BufDesc& desc = bufDescTable[frame];
+            if(desc.valid == true){
+                if(!evictFrame(frame)){
+                    break;
+                }
+                policy->onEvict(frame);
+            }else if(desc.pinCnt != 0){
+                // Reserved by allocBuf() for a page that is being read in.
+                break;
+            }
+            desc.Clear();
+            kept--;
+        }
+    }catch(...){
+        // Keep the frames drained before the write-back failed.
+        dropFrames(kept);
+        throw;
+    }
+    dropFrames(kept);
+    return kept == frames;
+}
+
+/*
+ * Function Name: dropFrames
+ * Input: uint32
+ * Output: None
+ * Purpose: Shrinks the pool to the given number of frames once the frames
+ * beyond it hold no page
+ */
+void BufMgr::dropFrames(const std::uint32_t frames)
+{
+    if(frames == numBufs){
+        return;
+    }
+    std::deque<FrameId> remaining;
+    for(std::size_t i = 0; i < freeFrames.size(); i++){
+        if(freeFrames[i] < frames){
+            remaining.push_back(freeFrames[i]);
+        }
+    }
+    freeFrames.swap(remaining);
+    numBufs = frames;
+    policy->resize(frames);
+    // The descriptors stay: lookups that raced with the shrink may still
+    // look at them, but never at the pages of frames that hold none.
+    bufPool.shrink(frames);
+}
+
+/*
+ * Function Name: noteAccess
+ * Input: File pointer, page number and number of the next page
+ * Output: None
+ * Purpose: Follows the reads of each file. Once two pages were read in chain
+ * order a batch of window pages is queued; reading the first page of that
+ * batch queues the next, twice as large, batch. Any other read resets the
+ * stream.
+ */
+void BufMgr::noteAccess(File* file, const PageId pageNo, const PageId next)
+{
+    std::lock_guard<std::mutex> guard(readaheadMutex);
+    if(maxReadahead == 0){
+        return;
+    }
+    std::map<const File*, ReadaheadStream>::iterator it = streams.find(file);
+    if(it == streams.end()){
+        ReadaheadStream fresh = ReadaheadStream();
+        fresh.expected = Page::INVALID_NUMBER;
+        it = streams.insert(std::make_pair(file, fresh)).first;
+    }
+    ReadaheadStream& stream = it->second;
+    if(pageNo != stream.expected){
+        stream.run = 0;
+        stream.window = std::min<std::uint32_t>(4, maxReadahead);
+        stream.marker = Page::INVALID_NUMBER;
+        stream.fetchFrom = Page::INVALID_NUMBER;
+        stream.extra = 0;
+    }
+    stream.run++;
+    stream.expected = next;
+    if(stream.run < 2 || next == Page::INVALID_NUMBER){
+        return;
+    }
+
+    PageId from;
+    if(stream.marker == Page::INVALID_NUMBER){
+        // Sequential access just detected: start right after this page.
+        if(stream.pending){
+            return;
+        }
+        from = next;
+    }else if(pageNo == stream.marker){
+        stream.window = std::min<std::uint32_t>(stream.window * 2, maxReadahead);
+        if(stream.pending){
+            // The thread is still on the previous batch; let it go on.
+            stream.extra = stream.window;
+            return;
+        }
+        from = stream.fetchFrom;
+        if(from == Page::INVALID_NUMBER){
+            return;
+        }
+    }else{
+        return;
+    }
+    stream.marker = from;
+    stream.pending = true;
+    ReadaheadRequest request = {file, from, stream.window};
+    readaheadQueue.push_back(request);
+    readaheadWake.notify_one();
+}
+
+/*
+ * Function Name: prefetchLoop
+ * Input: None
+ * Output: None
+ * Purpose: Takes batches off the readahead queue and reads their pages into
+ * the buffer pool along the page chain
+ */
+void BufMgr::prefetchLoop()
+{
+    std::unique_lock<std::mutex> guard(readaheadMutex);
+    while(!stopPrefetcher){
+        if(readaheadQueue.empty()){
+            readaheadWake.wait(guard);
+            continue;
+        }
+        ReadaheadRequest request = readaheadQueue.front();
+        readaheadQueue.pop_front();
+        prefetching = request.file;
+
+        PageId pageNo = request.pageNo;
+        std::uint32_t count = request.count;
+        for(;;){
+            guard.unlock();
+            bool ok = true;
+            while(count > 0 && pageNo != Page::INVALID_NUMBER){
+                PageId next;
+                if(!prefetchPage(request.file, pageNo, next)){
+                    ok = false;
+                    break;
+                }
+                pageNo = next;
+                count--;
+            }
+            guard.lock();
+            std::map<const File*, ReadaheadStream>::iterator it =
+                streams.find(request.file);
+            if(it == streams.end()){
+                break;
+            }
+            ReadaheadStream& stream = it->second;
+            if(ok && !stopPrefetcher && stream.extra > 0 &&
+               pageNo != Page::INVALID_NUMBER){
+                // The scan reached the batch before it was done; extend it.
+                stream.marker = pageNo;
+                count = stream.extra;
+                stream.extra = 0;
+                continue;
+            }
+            stream.fetchFrom = ok ? pageNo : Page::INVALID_NUMBER;
+            stream.extra = 0;
+            stream.pending = false;
+            break;
+        }
+        prefetching = NULL;
+        readaheadIdle.notify_all();
+    }
+}
+
+/*
+ * Function Name: prefetchPage
+ * Input: File pointer, page number and reference to the next page number
+ * Output: False if prefetching should stop
+ * Purpose: Reads a page into the buffer pool like readPage does, but leaves
+ * it unpinned. Pages that are resident already are only looked at to find
+ * the next page of the chain.
+ */
+bool BufMgr::prefetchPage(File* file, const PageId pageNo, PageId& next,
+                          const bool referenced, const bool freeOnly)
+{
+    FrameId frame;
+    {
+        std::lock_guard<std::mutex> guard(hashTable->latch(file, pageNo));
+        if(hashTable->find(file, pageNo, frame)){
+            next = bufPool[frame].next_page_number();
+            return true;
+        }
+    }
+    try{
+        std::lock_guard<std::mutex> pool(poolLatch);
+        if(freeFrames.empty() && (freeOnly || pinnedFrames == numBufs)){
+            // A full pool is no error for readahead; just stop.
+            return false;
+        }
+        allocBuf(frame, file, pageNo);
+    }catch(const BufferExceededException&){
+        // Hits pin frames without poolLatch, so the last unpinned frame may
+        // have been pinned since the check above.
+        return false;
+    }
+    try{
+        file->readPage(pageNo, bufPool[frame]);
+    }catch(...){
+        releaseFrame(frame);
+        return false;
+    }
+    bufStats.diskreads.add();
+    bufStats.addFile(file, &FileCounters::diskreads);
+    next = bufPool[frame].next_page_number();
+
+    std::lock_guard<std::mutex> pool(poolLatch);
+    bool unpinned = false;
+    {
+        std::lock_guard<std::mutex> guard(hashTable->latch(file, pageNo));
+        if(hashTable->tryInsert(file, pageNo, frame)){
+            bufDescTable[frame].Set(file, pageNo);
+            linkResident(frame);
+            bufDescTable[frame].refbit = referenced;
+            policy->onLoad(frame, file, pageNo);
+            unpinned = unpinFrame(frame);
+        }
+    }
+    if(!bufDescTable[frame].valid){
+        // A reader loaded the page first.
+        freeFrame(frame);
+        policy->onDispose(frame);
+    }else if(unpinned && policy->needsAccessHooks()){
+        policy->onUnpin(frame);
+    }
+    return true;
+}
+
+/*
+ * Function Name: cancelReadahead
+ * Input: File pointer
+ * Output: None
+ * Purpose: Forgets the file's readahead state, queued batches and warm-up
+ * pages, then waits until neither the prefetch nor the warm-up thread reads
+ * from the file
+ */
+void BufMgr::cancelReadahead(const File* file)
+{
+    {
+        std::unique_lock<std::mutex> warm(warmUpMutex);
+        for(std::deque<WarmUpEntry>::iterator it = warmUpQueue.begin();
+            it != warmUpQueue.end();){
+            if(it->file == file){
+                it = warmUpQueue.erase(it);
+            }else{
+                ++it;
+            }
+        }
+        while(warming == file){
+            warmUpIdle.wait(warm);
+        }
+    }
+    std::unique_lock<std::mutex> guard(readaheadMutex);
+    if(prefetcher == NULL){
+        return;
+    }
+    streams.erase(file);
+    for(std::deque<ReadaheadRequest>::iterator it = readaheadQueue.begin();
+        it != readaheadQueue.end();){
+        if(it->file == file){
+            it = readaheadQueue.erase(it);
+        }else{
+            ++it;
+        }
+    }
+    while(prefetching == file){
+        readaheadIdle.wait(guard);
+    }
+}
+
+/*
+ * Function Name: saveResidentSet
+ * Input: Snapshot path
+ * Output: False if the snapshot could not be written
+ * Purpose: Lists the pages in the pool under poolLatch, then writes them
+ * sorted by file name and page number to a temporary file that replaces
+ * the snapshot once complete. One line per page: page number, reference
+ * bit and file name.
+ */
+bool BufMgr::saveResidentSet(const std::string& path)
+{
+    std::vector<std::pair<std::string, std::pair<PageId, bool> > > pages;
+    {
+        std::lock_guard<std::mutex> pool(poolLatch);
+        for(std::map<const File*, std::vector<FrameId> >::const_iterator it =
+                residentFrames.begin(); it != residentFrames.end(); ++it){
+            const std::string& name = it->first->filename();
+            for(std::size_t i = 0; i < it->second.size(); i++){
+                const BufDesc& desc = bufDescTable[it->second[i]];
+                pages.push_back(std::make_pair(name,
+                    std::make_pair(PageId(desc.pageNo), bool(desc.refbit))));
+            }
+        }
+    }
+    std::sort(pages.begin(), pages.end());
+
+    const std::string temp = path + ".tmp";
+    {
+        std::ofstream out(temp.c_str(), std::ios::out | std::ios::trunc);
+        out << WARMUP_MAGIC << "\n";
+        for(std::size_t i = 0; i < pages.size(); i++){
+            out << pages[i].second.first << " " << pages[i].second.second
+                << " " << pages[i].first << "\n";
+        }
+        out.flush();
+        if(!out){
+            std::remove(temp.c_str());
+            return false;
+        }
+    }
+    return std::rename(temp.c_str(), path.c_str()) == 0;
+}
+
+/*
+ * Function Name: startWarmUp
+ * Input: Snapshot path and the open files
+ * Output: Number of pages queued
+ * Purpose: Reads the snapshot, keeps the pages of the given files in file
+ * and page order, and starts the warm-up thread on them
+ */
+std::size_t BufMgr::startWarmUp(const std::string& path,
+                                const std::vector<File*>& files)
+{
+    stopWarmUp();
+    std::ifstream in(path.c_str());
+    std::string line;
+    if(!std::getline(in, line) || line != WARMUP_MAGIC){
+        return 0;
+    }
+    std::map<std::string, File*> byName;
+    for(std::size_t i = 0; i < files.size(); i++){
+        byName[files[i]->filename()] = files[i];
+    }
+    // The snapshot is sorted already, but page order within a file is what
+    // keeps the reads sequential, so do not rely on it.
+    std::vector<std::pair<std::pair<File*, PageId>, bool> > pages;
+    while(std::getline(in, line)){
+        std::istringstream fields(line);
+        PageId pageNo;
+        bool referenced;
+        if(!(fields >> pageNo >> referenced)){
+            continue;
+        }
+        fields.get();
+        std::string name;
+        std::getline(fields, name);
+        std::map<std::string, File*>::const_iterator file = byName.find(name);
+        if(file != byName.end()){
+            pages.push_back(std::make_pair(std::make_pair(file->second, pageNo),
+                                           referenced));
+        }
+    }
+    std::sort(pages.begin(), pages.end());
+
+    std::lock_guard<std::mutex> guard(warmUpMutex);
+    for(std::size_t i = 0; i < pages.size(); i++){
+        WarmUpEntry entry = {pages[i].first.first, pages[i].first.second,
+                             pages[i].second};
+        warmUpQueue.push_back(entry);
+    }
+    if(!warmUpQueue.empty()){
+        stopWarmer = false;
+        warmer = new std::thread(&BufMgr::warmUpLoop, this);
+    }
+    return pages.size();
+}
+
+/*
+ * Function Name: stopWarmUp
+ * Input: None
+ * Output: None
+ * Purpose: Drops the pages not yet read and joins the warm-up thread
+ */
+void BufMgr::stopWarmUp()
+{
+    {
+        std::lock_guard<std::mutex> guard(warmUpMutex);
+        if(warmer == NULL){
+            return;
+        }
+        stopWarmer = true;
+        warmUpQueue.clear();
+    }
+    warmer->join();
+    delete warmer;
+    warmer = NULL;
+}
+
+/*
+ * Function Name: warmingUp
+ * Input: None
+ * Output: True while warm-up pages are being read
+ * Purpose: Tells whether the warm-up is still going on
+ */
+bool BufMgr::warmingUp()
+{
+    std::lock_guard<std::mutex> guard(warmUpMutex);
+    return !warmUpQueue.empty() || warming != NULL;
+}
+
+/*
+ * Function Name: warmUpLoop
+ * Input: None
+ * Output: None
+ * Purpose: Takes up to WARMUP_BATCH pages of one file at a time off the
+ * queue and reads them into free frames. Pages that cannot be read, e.g.
+ * because they were deleted since the snapshot, are skipped; once no free
+ * frame is left the remaining pages are dropped.
+ */
+void BufMgr::warmUpLoop()
+{
+    std::unique_lock<std::mutex> guard(warmUpMutex);
+    while(!stopWarmer && !warmUpQueue.empty()){
+        std::vector<WarmUpEntry> batch;
+        File* file = warmUpQueue.front().file;
+        while(!warmUpQueue.empty() && batch.size() < WARMUP_BATCH &&
+              warmUpQueue.front().file == file){
+            batch.push_back(warmUpQueue.front());
+            warmUpQueue.pop_front();
+        }
+        warming = file;
+        guard.unlock();
+
+        bool full = false;
+        for(std::size_t i = 0; i < batch.size() && !full; i++){
+            PageId next;
+            if(!prefetchPage(file, batch[i].pageNo, next, batch[i].referenced,
+                             true)){
+                std::lock_guard<std::mutex> pool(poolLatch);
+                full = freeFrames.empty();
+            }
+        }
+
+        guard.lock();
+        if(full){
+            warmUpQueue.clear();
+        }
+        warming = NULL;
+        warmUpIdle.notify_all();
+    }
+}
+
+/*
+ * Function Name: printSelf
+ * Input: void
+ * Output: void
+ * Purpose: Prints out the total number of valid frames in bufDescTable
+ * Iterates through bufDescTable and counts the number of frames whose valid
+ * bit is set to true. Then it prints that counted value.
+ */
+void BufMgr::printSelf(void)
+{
+  BufDesc* tmpbuf;
+	int validFrames = 0;
+
   for (std::uint32_t i = 0; i < numBufs; i++)
 	{
   	tmpbuf = &(bufDescTable[i]);
@@ -274,4 +2275,73 @@ void BufMgr::printSelf(void)
 	std::cout << "Total Number of Valid Frames:" << validFrames << "\n";
 }
 
+/*
+ * Function Name: checkInvariants
+ * Input: void
+ * Output: Description of the first inconsistency, or an empty string
+ * Purpose: Recounts the pinned, free and valid frames and looks every valid
+ * page up in the page table and in the resident frames of its file, to
+ * catch bookkeeping that drifted under concurrent use
+ */
+std::string BufMgr::checkInvariants()
+{
+    std::lock_guard<std::mutex> pool(poolLatch);
+    std::ostringstream problem;
+    std::uint32_t pinned = 0;
+    std::uint32_t valid = 0;
+    std::vector<bool> isFree(numBufs, false);
+    for(std::size_t i = 0; i < freeFrames.size(); i++){
+        const FrameId frame = freeFrames[i];
+        if(frame >= numBufs || isFree[frame]){
+            problem << "free list holds frame " << frame << " twice or beyond the pool";
+            return problem.str();
+        }
+        isFree[frame] = true;
+    }
+    for(FrameId i = 0; i < numBufs; i++){
+        const BufDesc& desc = bufDescTable[i];
+        if(desc.pinCnt != 0){
+            pinned++;
+        }
+        if(desc.valid == false){
+            if(!isFree[i]){
+                problem << "frame " << i << " holds no page but is not on the free list";
+                return problem.str();
+            }
+            continue;
+        }
+        valid++;
+        if(isFree[i]){
+            problem << "frame " << i << " holds page " << desc.pageNo << " but is on the free list";
+            return problem.str();
+        }
+        FrameId found;
+        if(!hashTable->find(desc.file, desc.pageNo, found) || found != i){
+            problem << "page " << desc.pageNo << " of frame " << i << " is not in the page table";
+            return problem.str();
+        }
+        std::map<const File*, std::vector<FrameId> >::const_iterator resident =
+            residentFrames.find(desc.file);
+        if(resident == residentFrames.end() || desc.fileSlot >= resident->second.size() ||
+           resident->second[desc.fileSlot] != i){
+            problem << "frame " << i << " is missing from the resident frames of its file";
+            return problem.str();
+        }
+    }
+    if(pinned != pinnedFrames){
+        problem << "pinnedFrames is " << pinnedFrames << " but " << pinned << " frames are pinned";
+        return problem.str();
+    }
+    std::size_t resident = 0;
+    for(std::map<const File*, std::vector<FrameId> >::const_iterator it =
+            residentFrames.begin(); it != residentFrames.end(); ++it){
+        resident += it->second.size();
+    }
+    if(resident != valid){
+        problem << resident << " resident frames listed for " << valid << " valid frames";
+        return problem.str();
+    }
+    return "";
+}
+
 }
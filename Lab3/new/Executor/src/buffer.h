@@ -8,10 +8,25 @@
 
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "bufHashTbl.h"
+#include "buf_stats.h"
 #include "file.h"
+#include "frame_array.h"
+#include "io_engine.h"
+#include "replacement.h"
 
 namespace badgerdb {
 
@@ -22,20 +37,30 @@ class BufMgr;
 
 /**
  * @brief Class for maintaining information about buffer pool frames
+ *
+ * pinCnt only changes while holding the page table latch of the page the
+ * frame holds, or the frame's latch when a page found without the page table
+ * latch is pinned.  A frame found unpinned under the page table latch may
+ * therefore still be pinned before its latch is taken.  file, pageNo,
+ * valid and fileSlot only change while holding BufMgr::poolLatch; a page is
+ * only taken out of a frame while also holding the frame's latch.
  */
 class BufDesc {
   friend class BufMgr;
+  friend class ReplacementPolicy;
+  template <class T>
+  friend class FrameArray;
 
  private:
   /**
    * Pointer to file to which corresponding frame is assigned
    */
-  File* file;
+  std::atomic<File*> file;
 
   /**
    * Page within file to which corresponding frame is assigned
    */
-  PageId pageNo;
+  std::atomic<PageId> pageNo;
 
   /**
    * Frame number of the frame, in the buffer pool, being used
@@ -45,22 +70,42 @@ class BufDesc {
   /**
    * Number of times this page has been pinned
    */
-  int pinCnt;
+  std::atomic<int> pinCnt;
 
   /**
    * True if page is dirty;  false otherwise
    */
-  bool dirty;
+  std::atomic<bool> dirty;
 
   /**
    * True if page is valid
    */
-  bool valid;
+  std::atomic<bool> valid;
 
   /**
    * Has this buffer frame been reference recently
    */
-  bool refbit;
+  std::atomic<bool> refbit;
+
+  /**
+   * Last access hint given for the page, reset when the frame gets a new
+   * page
+   */
+  std::atomic<AccessHint> hint;
+
+  /**
+   * Position of the frame in the list of resident frames of its file, while
+   * the frame holds a valid page
+   */
+  std::uint32_t fileSlot;
+
+  /**
+   * Held while the frame's page is being written back, whether for eviction
+   * or by the background writer, and while the page is taken out of the
+   * frame.  Readers pin the frame under it, so they wait for the write-back
+   * before touching the page
+   */
+  std::mutex latch;
 
   /**
    * Initialize buffer frame for a new user
@@ -72,6 +117,7 @@ class BufDesc {
     dirty = false;
     refbit = false;
     valid = false;
+    hint = HINT_NORMAL;
   };
 
   /**
@@ -89,11 +135,12 @@ class BufDesc {
     dirty = false;
     valid = true;
     refbit = true;
+    hint = HINT_NORMAL;
   }
 
   void Print() {
     if (file) {
-      std::cout << "file:" << file->filename() << " ";
+      std::cout << "file:" << file.load()->filename() << " ";
       std::cout << "pageNo:" << pageNo << " ";
     } else
       std::cout << "file:NULL ";
@@ -111,50 +158,160 @@ class BufDesc {
 };
 
 /**
- * @brief Class to maintain statistics of buffer usage
+ * @brief Access strategies that confine a bulk operation to a ring of frames.
+ */
+enum AccessStrategyType {
+  STRATEGY_BULK_READ,  // sequential scan of a table
+  STRATEGY_BULK_WRITE  // bulk load of a table
+};
+
+/**
+ * @brief Small private ring of frames recycled by a bulk scan or load.
+ *
+ * Pages read or allocated through a ring are put into the frame of the
+ * ring's next slot as long as that frame still holds the page the ring put
+ * there and is unpinned.  Otherwise a frame is allocated as usual and
+ * becomes the slot's frame.  A scan through a ring therefore takes at most
+ * size() frames away from other pages, however large the table is.
+ * Obtained from BufMgr::openStrategy(); a ring must be used by one thread
+ * at a time.
+ */
+class BufferRing {
+  friend class BufMgr;
+
+ public:
+  /**
+   * Number of slots in the ring
+   */
+  std::uint32_t size() const { return frames.size(); }
+
+ private:
+  explicit BufferRing(std::uint32_t slots);
+
+  /**
+   * Frame of each slot and the page the ring put into it
+   */
+  std::vector<FrameId> frames;
+  std::vector<PageKey> pages;
+
+  /**
+   * Slot to be recycled next
+   */
+  std::uint32_t next;
+};
+
+class BufMgr;
+
+/**
+ * @brief Pin on a buffered page that is released when the handle goes away.
+ *
+ * Returned by the BufMgr::readPage() and BufMgr::allocPage() overloads that
+ * take no page pointer.  The handle remembers the frame, so unpinning needs
+ * no hashTable lookup.  Handles can be moved but not copied; an empty
+ * (default-constructed or moved-from) handle holds no pin.
  */
-struct BufStats {
+class PageHandle {
+  friend class BufMgr;
+
+ public:
+  /**
+   * Constructs an empty handle
+   */
+  PageHandle();
+
+  PageHandle(PageHandle&& other);
+  PageHandle& operator=(PageHandle&& other);
+
   /**
-   * Total number of accesses to buffer pool
+   * Unpins the page, writing it back later if it was marked dirty
    */
-  int accesses;
+  ~PageHandle() { release(); }
 
   /**
-   * Number of pages read from disk (including allocs)
+   * True if the handle holds a pin
    */
-  int diskreads;
+  explicit operator bool() const { return bufMgr != NULL; }
+
+  Page* get() const { return page; }
+  Page& operator*() const { return *page; }
+  Page* operator->() const { return page; }
 
   /**
-   * Number of pages written back to disk
+   * Number of the pinned page
    */
-  int diskwrites;
+  PageId pageNo() const { return pageNumber; }
 
   /**
-   * Clear all values
+   * Records that the page was modified; it is written back before its frame
+   * is reused.
    */
-  void clear() { accesses = diskreads = diskwrites = 0; }
+  void markDirty() { dirty = true; }
 
   /**
-   * Constructor of BufStats class
+   * Unpins the page now and empties the handle.
+   *
+   * @param hint  Access hint for the page, as for BufMgr::unPinPage()
    */
-  BufStats() { clear(); }
+  void release(AccessHint hint = HINT_NORMAL);
+
+ private:
+  PageHandle(BufMgr* bufMgr, File* file, const PageId pageNo,
+             const FrameId frame, Page* page);
+
+  PageHandle(const PageHandle&) = delete;
+  PageHandle& operator=(const PageHandle&) = delete;
+
+  BufMgr* bufMgr;
+  File* file;
+  PageId pageNumber;
+  FrameId frame;
+  Page* page;
+  bool dirty;
 };
 
 /**
  * @brief The central class which manages the buffer pool including frame
  * allocation and deallocation to pages in the file
+ *
+ * readPage(), unPinPage(), allocPage(), disposePage() and flushFile() may be
+ * called from several threads at once.  Hits look the page up without any
+ * latch and only take the latch of the frame they pin; misses and evictions
+ * latch a page table partition and serialize on poolLatch.
+ * A page must not be modified unless the calling thread holds a pin on it.
  */
 class BufMgr {
+  friend class PageHandle;
+
  private:
   /**
-   * Current position of clockhand in our buffer pool
+   * Alignment of the buffer pool; Page::SIZE is a multiple of it, so every
+   * frame is aligned as well
+   */
+  static const std::size_t FRAME_ALIGNMENT = 4096;
+
+  /**
+   * Number of times resize() lets go of the pool latch and waits a
+   * millisecond for pinned frames at the end of the pool
+   */
+  static const int RESIZE_RETRIES = 100;
+
+  /**
+   * Number of pages of one file the warm-up thread reads between checks for
+   * cancellation
    */
-  FrameId clockHand;
+  static const std::uint32_t WARMUP_BATCH = 64;
 
   /**
-   * Number of frames in the buffer pool
+   * Share of the frames one write-back batch may pin at a time, as a
+   * divisor, so that misses during a checkpoint still find victims
    */
-  std::uint32_t numBufs;
+  static const std::uint32_t WRITEBACK_SHARE = 4;
+
+  /**
+   * Number of frames in the buffer pool.  Only changes in resize(), under
+   * poolLatch.
+   */
+  std::atomic<std::uint32_t> numBufs;
 
   /**
    * Hash table mapping (File, page) to frame
@@ -163,9 +320,11 @@ class BufMgr {
 
   /**
    * Array of BufDesc objects to hold information corresponding to every frame
-   * allocation from 'bufPool' (the buffer pool)
+   * allocation from 'bufPool' (the buffer pool).  Never shrinks, so a frame
+   * number found in the hashTable just before the pool shrank can still be
+   * checked against its descriptor.
    */
-  BufDesc* bufDescTable;
+  FrameArray<BufDesc> bufDescTable;
 
   /**
    * Maintains Buffer pool usage statistics
@@ -173,30 +332,542 @@ class BufMgr {
   BufStats bufStats;
 
   /**
-   * Advance clock to next frame in the buffer pool
+   * Replacement policy choosing the frames handed out by allocBuf()
+   */
+  ReplacementPolicy* policy;
+
+  /**
+   * Serializes calls into the replacement policy and every change of the
+   * page a frame is assigned to.  Acquired before any page table latch.
+   */
+  std::mutex poolLatch;
+
+  /**
+   * Serializes calls into File that write pages or change the file header.
+   * Page reads use pread() and take no latch.
+   */
+  std::mutex ioLatch;
+
+  /**
+   * Frames which hold no page, handed out by allocBuf() before the
+   * replacement policy is asked for a victim.  Protected by poolLatch.
+   */
+  std::deque<FrameId> freeFrames;
+
+  /**
+   * Frames holding a valid page of each file, in no particular order, so
+   * that work on one file need not scan the whole pool.  A file has an
+   * entry only while it has pages in the pool.  Protected by poolLatch.
+   */
+  std::map<const File*, std::vector<FrameId> > residentFrames;
+
+  /**
+   * Adds a frame that has just received a valid page to, or removes a frame
+   * whose page is being taken out from, the resident frames of its file.
+   * Caller must hold poolLatch.
+   */
+  void linkResident(const FrameId frame);
+  void unlinkResident(const FrameId frame);
+
+  /**
+   * Number of frames with a non-zero pin count.  When it equals numBufs no
+   * frame can be evicted and allocBuf() fails without asking the policy.
+   */
+  std::atomic<std::uint32_t> pinnedFrames;
+
+  /**
+   * Increments the pin count of a frame.  Caller must hold the page table
+   * latch of the frame's page or the frame's latch, or poolLatch if the frame
+   * holds no page.
+   */
+  void pinFrame(const FrameId frame);
+
+  /**
+   * Decrements the pin count of a frame.  Caller must hold the page table
+   * latch of the frame's page, or poolLatch if the frame holds no page.
+   *
+   * @return  True if the frame is now unpinned.
+   */
+  bool unpinFrame(const FrameId frame);
+
+  /**
+   * Releases a pin taken through a PageHandle.  Does nothing if the page has
+   * left the frame in the meantime, i.e. was disposed of.
+   *
+   * @param frame   Frame the page was pinned in
+   * @param file   	File object
+   * @param pageNo  Page number
+   * @param dirty		True if the page needs to be marked dirty
+   * @param hint    Access hint given with the unpin
+   */
+  void releasePin(const FrameId frame, File* file, const PageId pageNo,
+                  const bool dirty, const AccessHint hint);
+
+  /**
+   * Tells the replacement policy that the frame's pin count dropped to
+   * zero, and queues it for early replacement if its hint asks for that.
    */
-  void advanceClock();
+  void noteUnpinned(const FrameId frame);
 
   /**
-   * Allocate a free frame.
+   * Clears a frame and puts it on the free list.  Caller must hold poolLatch
+   * and must have removed the frame's page from the hashTable.
+   */
+  void freeFrame(const FrameId frame);
+
+  /**
+   * Pins the frame holding (file, pageNo) if the page is resident, waiting
+   * for any write-back of that frame to finish.  The lookup takes no latch;
+   * the pin takes the frame's latch, so only hits of the same frame contend.
+   * Sets the reference bit unless the hint is HINT_SEQUENTIAL_ONCE.
+   *
+   * @param file   	File object
+   * @param pageNo  Page number in the file
+   * @param frame   Frame ID of the pinned frame returned via this variable
+   * @param hint    Access hint of the read
+   * @return  False if the page is not in the buffer pool.
+   */
+  bool pinResident(File* file, const PageId pageNo, FrameId& frame,
+                   const AccessHint hint);
+
+  /**
+   * Detaches an unpinned frame from its page: writes the page back if dirty
+   * and removes it from the hashTable.  Caller must hold poolLatch.
+   *
+   * @param frame   Frame to evict
+   * @return  False if the frame is pinned; the frame is then left untouched.
+   */
+  bool evictFrame(const FrameId frame);
+
+  /**
+   * Returns the page numbers held by the frames, sorted.  Caller must hold
+   * poolLatch.
+   */
+  std::vector<PageId> residentPages(const std::vector<FrameId>& frames) const;
+
+  /**
+   * Writes the dirty, unpinned pages among the given ones back, each run of
+   * consecutive page numbers with one write.  Pages found pinned, clean or
+   * no longer in the pool are skipped.  Needs no poolLatch.
+   *
+   * @param file     File all the pages belong to
+   * @param pageNos  Page numbers in ascending order
+   */
+  void writeBackRuns(File* file, const std::vector<PageId>& pageNos);
+
+  /**
+   * Writes the runs pinned and latched by writeBackRuns(), then marks them
+   * clean and releases them.
+   *
+   * @param file   File all the pages belong to
+   * @param runs   Frames of each run, in page order
+   * @param pages  Pages of each run, in page order
+   */
+  void writeRuns(File* file, const std::vector<std::vector<FrameId> >& runs,
+                 const std::vector<std::vector<const Page*> >& pages);
+
+  /**
+   * Writes back and evicts every page of the file in the buffer pool.
+   * Caller must hold poolLatch.
+   *
+   * @param file   	File object
+   * @throws  PagePinnedException If any page of the file is pinned
+   * @throws BadBufferException If any frame of the file is invalid
+   */
+  void evictFile(const File* file);
+
+  /**
+   * Returns a frame reserved by allocBuf() but not filled to the free pool.
+   */
+  void releaseFrame(const FrameId frame);
+
+  /**
+   * Background writer thread, or NULL if it is not running
+   */
+  std::thread* writer;
+
+  /**
+   * Number of clean, unpinned frames the background writer tries to keep
+   */
+  std::uint32_t cleanLowWater;
+
+  /**
+   * Set to ask the background writer to exit
+   */
+  bool stopWriter;
+
+  /**
+   * Protects stopWriter and is used to wake up the background writer
+   */
+  std::mutex writerMutex;
+  std::condition_variable writerWake;
+
+  /**
+   * Main loop of the background writer thread
+   */
+  void backgroundWriter();
+
+  /**
+   * Writes back dirty unpinned frames, in the order the replacement policy
+   * will pick them, until cleanLowWater frames are clean or free.
+   */
+  void cleanAhead();
+
+  /**
+   * Writes the page of a dirty, unpinned frame back without evicting it.
+   *
+   * @param frame   Frame to clean
+   * @return  False if the frame was not dirty, was pinned or holds no page.
+   */
+  bool cleanFrame(const FrameId frame);
+
+  /**
+   * Waits until a write-back of the frame by the background writer, if any,
+   * has finished.
+   */
+  void waitForWriteBack(const FrameId frame);
+
+  /**
+   * @brief Sequential access state of one file, used for readahead
+   */
+  struct ReadaheadStream {
+    /**
+     * Successor of the page read last, i.e. the page a sequential scan
+     * reads next
+     */
+    PageId expected;
+
+    /**
+     * Number of pages read in chain order so far
+     */
+    std::uint32_t run;
+
+    /**
+     * Number of pages prefetched at a time; doubles while the scan goes on
+     */
+    std::uint32_t window;
+
+    /**
+     * First page of the last prefetched batch.  Reading it issues the next
+     * batch, so prefetching stays one window ahead of the scan.
+     */
+    PageId marker;
+
+    /**
+     * Page the next batch starts at
+     */
+    PageId fetchFrom;
+
+    /**
+     * True while the prefetch thread works on a batch of this file, and the
+     * number of pages it should add to that batch
+     */
+    bool pending;
+    std::uint32_t extra;
+  };
+
+  /**
+   * @brief Batch of pages to prefetch, following the page chain
+   */
+  struct ReadaheadRequest {
+    File* file;
+    PageId pageNo;
+    std::uint32_t count;
+  };
+
+  /**
+   * Largest readahead window in pages; 0 while readahead is off
+   */
+  std::atomic<std::uint32_t> maxReadahead;
+
+  /**
+   * Prefetch thread, or NULL if readahead is off
+   */
+  std::thread* prefetcher;
+
+  /**
+   * Set to ask the prefetch thread to exit
+   */
+  bool stopPrefetcher;
+
+  /**
+   * Sequential access state per file and the queue of pending batches,
+   * both protected by readaheadMutex
+   */
+  std::map<const File*, ReadaheadStream> streams;
+  std::deque<ReadaheadRequest> readaheadQueue;
+
+  /**
+   * File the prefetch thread is reading from, or NULL
+   */
+  const File* prefetching;
+
+  std::mutex readaheadMutex;
+  std::condition_variable readaheadWake;
+  std::condition_variable readaheadIdle;
+
+  /**
+   * Main loop of the prefetch thread
+   */
+  void prefetchLoop();
+
+  /**
+   * @brief Page listed in a resident-set snapshot, to be read back in
+   */
+  struct WarmUpEntry {
+    File* file;
+    PageId pageNo;
+    bool referenced;
+  };
+
+  /**
+   * Warm-up thread, or NULL if none was started
+   */
+  std::thread* warmer;
+
+  /**
+   * Set to ask the warm-up thread to exit
+   */
+  bool stopWarmer;
+
+  /**
+   * Pages still to be read by the warm-up thread, sorted by file and page
+   * number, protected by warmUpMutex
+   */
+  std::deque<WarmUpEntry> warmUpQueue;
+
+  /**
+   * File the warm-up thread is reading from, or NULL
+   */
+  const File* warming;
+
+  std::mutex warmUpMutex;
+  std::condition_variable warmUpIdle;
+
+  /**
+   * Path the destructor saves the resident set to; empty for none
+   */
+  std::string shutdownSnapshot;
+
+  /**
+   * Main loop of the warm-up thread
+   */
+  void warmUpLoop();
+
+  /**
+   * Pools created by createPool(), by name; owned by this pool and
+   * protected by poolsLatch
+   */
+  std::map<std::string, BufMgr*> pools;
+
+  /**
+   * Pool each bound file name is routed to, or NULL while no file is bound.
+   * A new map replaces the old one on every change, so routing reads it
+   * without a latch.
+   */
+  std::atomic<const std::map<std::string, BufMgr*>*> bindings;
+
+  /**
+   * Number of binding changes so far.  A thread looking a file up counts
+   * itself in bindingReaders[bindingEpoch % 2]; a change bumps the epoch
+   * and frees the replaced map once the readers of the old epoch are gone.
+   */
+  std::atomic<std::uint32_t> bindingEpoch;
+  std::atomic<std::uint32_t> bindingReaders[2];
+
+  std::mutex poolsLatch;
+
+  /**
+   * Engine chosen with setIoEngine(), or NULL to use the one shared by all
+   * pools of the process; protected by ioEngineLatch
+   */
+  std::shared_ptr<IoEngine> ioEngine;
+  std::mutex ioEngineLatch;
+
+  /**
+   * Returns the pool that serves the pages of the file: the pool it is
+   * bound to, or this one.
+   */
+  BufMgr* route(const File* file);
+
+  /**
+   * Routes the file name to pool, or back to this pool if pool is NULL.
+   * Caller must hold poolsLatch.
+   */
+  void setBinding(const std::string& filename, BufMgr* pool);
+
+  /**
+   * Routes the file from one pool to another, this pool included, and
+   * flushes it from the pool it leaves.  Caller must hold poolsLatch.
+   *
+   * @throws  PagePinnedException If a page of the file is pinned in from;
+   * the file stays routed to from then.
+   */
+  void moveFile(const File* file, BufMgr* from, BufMgr* to);
+
+  /**
+   * Writes back and evicts the file's pages in this pool, then syncs the
+   * file; flushFile() without routing.
+   */
+  void flushResident(const File* file);
+
+  /**
+   * Records a read of the page by readPage() and queues a batch of
+   * prefetches if the file is being read along its page chain.
+   *
+   * @param file   	File object
+   * @param pageNo  Page number that was read
+   * @param next    Number of the page following it in the file
+   */
+  void noteAccess(File* file, const PageId pageNo, const PageId next);
+
+  /**
+   * Brings the page into the buffer pool without pinning it.
+   *
+   * @param file   	File object
+   * @param pageNo  Page number to prefetch
+   * @param next    Number of the page following it, returned via this
+   * variable
+   * @param referenced  Reference bit the frame gets if the page is loaded
+   * @param freeOnly    Only use a free frame, never evict a page
+   * @return  False if the page could not be read or no frame was available.
+   */
+  bool prefetchPage(File* file, const PageId pageNo, PageId& next,
+                    const bool referenced = true, const bool freeOnly = false);
+
+  /**
+   * Drops the readahead state, queued batches and pending warm-up reads of
+   * the file and waits for the background threads to stop reading from it.
+   */
+  void cancelReadahead(const File* file);
+
+  /**
+   * Allocate a free frame, writing back and evicting its current page if
+   * necessary.  Caller must hold poolLatch.  The frame is returned invalid
+   * and with a pin count of one, so no other thread can pick it until the
+   * caller installs a page or hands it back with releaseFrame().
    *
    * @param frame   	Frame reference, frame ID of allocated frame returned via
    * this variable
+   * @param file   	File of the page the frame is needed for
+   * @param pageNo  Page number of the page the frame is needed for
    * @throws BufferExceededException If no such buffer is found which can be
    * allocated
    */
-  void allocBuf(FrameId& frame);
+  void allocBuf(FrameId& frame, const File* file, const PageId pageNo);
+
+  /**
+   * Allocates a frame for the given page from the ring: recycles the frame
+   * of the ring's next slot if it still holds the ring's page and is
+   * unpinned, and falls back to allocBuf() otherwise.  Caller must hold
+   * poolLatch.
+   */
+  void allocRingBuf(BufferRing* ring, FrameId& frame, File* file,
+                    const PageId pageNo);
+
+  /**
+   * Reads the page into a frame and pins it; see readPage().
+   *
+   * @return  Frame holding the page.
+   */
+  FrameId readFrame(File* file, const PageId pageNo, BufferRing* ring,
+                    const AccessHint hint);
+
+  /**
+   * Enters a page just read into a frame reserved by allocBuf() into the
+   * page table, or, if another thread has read the page meanwhile, pins
+   * that thread's frame and releases the reserved one.
+   *
+   * @param frame   Frame the page was read into
+   * @param loaded  Set to true if the page was entered in frame
+   * @return  Frame holding the page, pinned.
+   */
+  FrameId installFrame(File* file, const PageId pageNo, FrameId frame,
+                       BufferRing* ring, const AccessHint hint, bool& loaded);
+
+  /**
+   * Applies the hint of a read to the frame it pinned and reports a hit to
+   * the replacement policy unless the read loaded the page.
+   */
+  void finishRead(const FrameId frame, const bool loaded,
+                  const AccessHint hint);
+
+  /**
+   * A miss of readPageAsync() whose read is in flight
+   */
+  struct PendingRead;
+
+  /**
+   * Returns the engine for asynchronous reads and write-back batches.  Hold
+   * the pointer while submitting, so that setIoEngine() cannot destroy the
+   * engine meanwhile.
+   */
+  std::shared_ptr<IoEngine> engine();
+
+  /**
+   * Allocates a page in a frame and pins it; see allocPage().
+   *
+   * @return  Frame holding the page.
+   */
+  FrameId allocFrame(File* file, PageId& pageNo, BufferRing* ring);
+
+  /**
+   * Shrinks the pool towards the given number of frames as far as the frames
+   * at its end are unpinned.  Caller must hold poolLatch.
+   *
+   * @return  True if the pool now has the given number of frames.
+   */
+  bool drainFrames(const std::uint32_t frames);
+
+  /**
+   * Drops the frames from the given one on: takes them off the free list,
+   * adapts the policy and releases their memory.  Caller must hold poolLatch
+   * and have taken every page out of them.
+   */
+  void dropFrames(const std::uint32_t frames);
+
+  /**
+   * Returns frames if a pool can have that many.
+   *
+   * @throws std::invalid_argument  If frames exceeds MAX_FRAMES
+   */
+  static std::uint32_t checkFrames(const std::uint32_t frames);
 
  public:
   /**
-   * Actual buffer pool from which frames are allocated
+   * Largest number of frames a buffer pool can have, 1,048,576.  The frames
+   * are found through a chunk directory of fixed size, so that indexing
+   * needs no latch while the pool is resized.
+   */
+  static const std::uint32_t MAX_FRAMES = FrameArray<Page>::MAX_FRAMES;
+
+  /**
+   * Actual buffer pool from which frames are allocated.  Its memory is mapped
+   * in huge-page chunks.
    */
-  Page* bufPool;
+  FrameArray<Page> bufPool;
 
   /**
    * Constructor of BufMgr class
+   *
+   * @param bufs      Number of frames in the buffer pool
+   * @param type      Replacement policy used to pick victim frames
+   * @param prefault  Touch all frame memory up front, including frames added
+   * by resize(), trading startup time for steady first-access latency
+   * @throws std::invalid_argument  If bufs exceeds MAX_FRAMES
    */
-  BufMgr(std::uint32_t bufs);
+  BufMgr(std::uint32_t bufs, ReplacementPolicyType type = POLICY_CLOCK,
+         bool prefault = false);
+
+  /**
+   * Constructor of BufMgr class taking a caller-supplied replacement policy.
+   *
+   * @param bufs      Number of frames in the buffer pool
+   * @param policy    Policy built for bufs frames; BufMgr takes ownership
+   * @param prefault  Touch all frame memory up front
+   * @throws std::invalid_argument  If bufs exceeds MAX_FRAMES
+   */
+  BufMgr(std::uint32_t bufs, ReplacementPolicy* policy, bool prefault = false);
 
   /**
    * Destructor of BufMgr class
@@ -213,8 +884,63 @@ class BufMgr {
    * @param PageNo  Page number in the file to be read
    * @param page  	Reference to page pointer. Used to fetch the Page object in
    * which requested page from file is read in.
+   * @param ring    Access strategy ring to read the page into on a miss, or
+   * NULL to use the whole buffer pool
+   * @param hint    How the page will be used: HINT_KEEP_HOT keeps it in the
+   * pool until it is evicted or hinted otherwise, HINT_EVICT_NEXT marks it
+   * for replacement once unpinned, and HINT_SEQUENTIAL_ONCE does not count
+   * the read as a reuse and marks the page for early replacement, unless it
+   * is kept hot
+   */
+  void readPage(File* file, const PageId PageNo, Page*& page,
+                BufferRing* ring = NULL, AccessHint hint = HINT_NORMAL);
+
+  /**
+   * Starts reading the given page and returns without waiting for the disk,
+   * so a scan can keep many reads in flight.  A resident page is pinned at
+   * once.  On a miss a frame is reserved and the read submitted to the I/O
+   * engine; getting the future waits for the read and enters the page in the
+   * pool on the calling thread, so the future is deferred and cannot be
+   * polled.  Dropping the future unread releases the frame.
+   *
+   * @param file   	File object
+   * @param PageNo  Page number in the file to be read
+   * @param hint    Access hint, as for readPage()
+   * @return  Future of a handle holding the pin on the page; getting it
+   *          throws what readPage() would.
+   */
+  std::future<PageHandle> readPageAsync(File* file, const PageId PageNo,
+                                        AccessHint hint = HINT_NORMAL);
+
+  /**
+   * Gives this pool an engine of its own for asynchronous reads and
+   * write-back, replacing any it had once its requests are done.  By
+   * default every pool uses one engine shared by the process, on io_uring
+   * where the kernel allows it and on worker threads otherwise.
+   *
+   * @param type  Kind of engine
+   * @return  False if the kernel does not support the kind; the engine is
+   *          then left as it was.
+   */
+  bool setIoEngine(const IoEngineType type);
+
+  /**
+   * Returns the name of the engine asynchronous I/O runs on.
+   */
+  const char* ioEngineName();
+
+  /**
+   * Reads the given page like readPage() above and returns a handle that
+   * unpins it when it goes out of scope.
+   *
+   * @param file   	File object
+   * @param PageNo  Page number in the file to be read
+   * @param ring    Access strategy ring, or NULL
+   * @param hint    Access hint, as for readPage() above
+   * @return  Handle holding the pin on the page.
    */
-  void readPage(File* file, const PageId PageNo, Page*& page);
+  PageHandle readPage(File* file, const PageId PageNo,
+                      BufferRing* ring = NULL, AccessHint hint = HINT_NORMAL);
 
   /**
    * Unpin a page from memory since it is no longer required for it to remain in
@@ -224,9 +950,14 @@ class BufMgr {
    * @param PageNo  Page number
    * @param dirty		True if the page to be unpinned needs to be marked
    * dirty
+   * @param hint    Access hint replacing the page's current one:
+   * HINT_EVICT_NEXT makes the page the next to be replaced once no longer
+   * pinned, HINT_SEQUENTIAL_ONCE queues it for replacement behind such
+   * pages, HINT_KEEP_HOT keeps it in the pool.  HINT_NORMAL changes nothing.
    * @throws  PageNotPinnedException If the page is not already pinned
    */
-  void unPinPage(File* file, const PageId PageNo, const bool dirty);
+  void unPinPage(File* file, const PageId PageNo, const bool dirty,
+                 AccessHint hint = HINT_NORMAL);
 
   /**
    * Allocates a new, empty page in the file and returns the Page object.
@@ -237,11 +968,26 @@ class BufMgr {
    * returned via this reference.
    * @param page  	Reference to page pointer. The newly allocated in-memory
    * Page object is returned via this reference.
+   * @param ring    Access strategy ring to put the page into, or NULL to use
+   * the whole buffer pool
+   */
+  void allocPage(File* file, PageId& PageNo, Page*& page,
+                 BufferRing* ring = NULL);
+
+  /**
+   * Allocates a new page like allocPage() above and returns a handle that
+   * unpins it when it goes out of scope.
+   *
+   * @param file   	File object
+   * @param ring    Access strategy ring, or NULL
+   * @return  Handle holding the pin on the new page.
    */
-  void allocPage(File* file, PageId& PageNo, Page*& page);
+  PageHandle allocPage(File* file, BufferRing* ring = NULL);
 
   /**
-   * Writes out all dirty pages of the file to disk.
+   * Writes out all dirty pages of the file to disk, in page number order and
+   * with runs of consecutive pages coalesced, then removes the file's pages
+   * from the buffer pool and syncs the file with File::sync().
    * All the frames assigned to the file need to be unpinned from buffer pool
    * before this function can be successfully called. Otherwise Error returned.
    *
@@ -253,6 +999,13 @@ class BufMgr {
    */
   void flushFile(const File* file);
 
+  /**
+   * Writes back the dirty, unpinned pages of every file with pages in this
+   * pool and in the named pools, leaving them resident, then syncs those
+   * files.  Pages pinned meanwhile stay dirty.
+   */
+  void checkpoint();
+
   /**
    * Delete page from file and also from buffer pool if present.
    * Since the page is entirely deleted from file, its unnecessary to see if the
@@ -263,11 +1016,184 @@ class BufMgr {
    */
   void disposePage(File* file, const PageId PageNo);
 
+  /**
+   * Starts a background thread that writes dirty unpinned pages back ahead
+   * of the replacement policy, so that allocating a frame rarely has to wait
+   * for a write.  Does nothing if the writer is already running.
+   *
+   * @param lowWater  Number of clean or free frames to keep available
+   */
+  void startBackgroundWriter(std::uint32_t lowWater);
+
+  /**
+   * Stops the background writer and waits for it to exit.
+   */
+  void stopBackgroundWriter();
+
+  /**
+   * Creates a ring of frames for a bulk scan or load, so that it does not
+   * push the rest of the working set out of the pool.  The ring is sized
+   * for the strategy but never takes more than an eighth of the pool.
+   *
+   * @param type    Kind of bulk operation
+   * @return  New ring; release it with closeStrategy().
+   */
+  BufferRing* openStrategy(AccessStrategyType type);
+
+  /**
+   * Releases a ring created by openStrategy().  Its pages stay in the pool
+   * and are replaced like any other page.
+   */
+  void closeStrategy(BufferRing* ring);
+
+  /**
+   * Turns on sequential readahead.  When readPage() is called for pages in
+   * the order of the file's page chain, as file scans do, a background
+   * thread reads the following pages into the pool before they are asked
+   * for.  The number of pages read ahead starts small and doubles while the
+   * scan goes on, up to maxPages.  Files being read ahead must be flushed
+   * before their File object is destroyed.
+   *
+   * @param maxPages  Largest number of pages to read ahead of a scan
+   */
+  void startReadahead(std::uint32_t maxPages);
+
+  /**
+   * Turns off readahead and waits for the prefetch thread to exit.
+   */
+  void stopReadahead();
+
+  /**
+   * Writes the list of pages in the buffer pool to a snapshot file: the name
+   * of each page's file, its page number and its reference bit, sorted by
+   * file and page.  The file is replaced atomically.
+   *
+   * @param path  Snapshot file to write
+   * @return  False if the snapshot could not be written.
+   */
+  bool saveResidentSet(const std::string& path);
+
+  /**
+   * Makes the destructor save the resident set to path with
+   * saveResidentSet() before it flushes the pool; an empty path turns this
+   * off again.
+   */
+  void setShutdownSnapshot(const std::string& path) { shutdownSnapshot = path; }
+
+  /**
+   * Starts a background thread that reads the pages listed in a snapshot
+   * written by saveResidentSet() back into the pool, file by file in page
+   * order and in batches, while the pool serves requests as usual.  Pages
+   * get their saved reference bit.  Only free frames are used, so the
+   * warm-up never evicts pages that requests brought in; it ends when the
+   * pool is full.  Pages of files not among files are skipped, and the
+   * files must stay open until the warm-up ends, is stopped or they are
+   * flushed.  A warm-up still running is stopped first.
+   *
+   * @param path   Snapshot file to read; a missing file warms up nothing
+   * @param files  Open files, matched to the snapshot by file name
+   * @return  Number of pages queued for reading.
+   */
+  std::size_t startWarmUp(const std::string& path,
+                          const std::vector<File*>& files);
+
+  /**
+   * Drops the pages not yet read back and waits for the warm-up thread to
+   * exit.
+   */
+  void stopWarmUp();
+
+  /**
+   * Returns true until the warm-up thread has read or dropped every page.
+   */
+  bool warmingUp();
+
+  /**
+   * Creates a separate buffer pool with its own frames, replacement policy
+   * and statistics, to which files can be bound with bindFile(), e.g. to
+   * keep temporary and spill files from evicting base table pages.  The
+   * new pool is owned by this one and destroyed with it.  Its background
+   * threads, if wanted, are started on the returned pool.
+   *
+   * @param name  Name of the pool
+   * @param bufs  Number of frames in the pool
+   * @param type  Replacement policy of the pool
+   * @return  The new pool, or the existing one if a pool of that name was
+   * created before.
+   */
+  BufMgr* createPool(const std::string& name, std::uint32_t bufs,
+                     ReplacementPolicyType type = POLICY_CLOCK);
+
+  /**
+   * Returns the pool created under the given name, or NULL.
+   */
+  BufMgr* getPool(const std::string& name);
+
+  /**
+   * Binds a file to a named pool: from now on readPage(), allocPage(),
+   * unPinPage(), flushFile() and disposePage() calls for the file are
+   * passed on to that pool, and rings given with them are not used.  Files
+   * are matched by name, so every File object opened on the file is routed
+   * the same way.  The file's pages are flushed from the pool that served it
+   * so far, after the file is routed to the new one, so none of them may be
+   * pinned; if one is, the file is left where it was.
+   *
+   * @param file  File to bind
+   * @param pool  Name of a pool created by createPool()
+   * @return  False if there is no pool of that name; nothing is changed
+   * then.
+   * @throws  PagePinnedException If a page of the file is pinned
+   */
+  bool bindFile(const File* file, const std::string& pool);
+
+  /**
+   * Routes the file back to this pool and flushes it from the pool it was
+   * bound to.  Does nothing if the file is not bound.
+   *
+   * @throws  PagePinnedException If a page of the file is pinned; the file
+   * stays bound then.
+   */
+  void unbindFile(const File* file);
+
+  /**
+   * Grows or shrinks the buffer pool while it is in use.  New frames are
+   * added to the free list.  Shrinking drains frames from the end of the
+   * pool: their pages are written back if dirty and evicted.  Pinned pages
+   * are never moved or disturbed; if a frame at the end stays pinned for
+   * about a tenth of a second, the pool is left larger than asked for.
+   *
+   * @param frames  Number of frames wanted, at least one
+   * @return  Number of frames in the buffer pool afterwards.
+   * @throws std::invalid_argument  If frames exceeds MAX_FRAMES
+   * @throws std::bad_alloc  If the memory for new frames cannot be allocated
+   */
+  std::uint32_t resize(std::uint32_t frames);
+
+  /**
+   * Returns the number of frames in the buffer pool.
+   */
+  std::uint32_t size() const { return numBufs; }
+
+  /**
+   * Returns the replacement policy in use.
+   */
+  const ReplacementPolicy* getPolicy() const { return policy; }
+
   /**
    * Print member variable values.
    */
   void printSelf();
 
+  /**
+   * Checks the bookkeeping of the pool against its frames: pinnedFrames
+   * against the pin counts, the free list against the frames holding no
+   * page, and the page table and resident lists against the frames holding
+   * one.  Meant for tests, while no other thread uses the pool.
+   *
+   * @return  Description of the first inconsistency found, or "" if none.
+   */
+  std::string checkInvariants();
+
   /**
    * Get buffer pool usage statistics
    */
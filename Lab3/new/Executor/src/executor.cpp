@@ -36,7 +36,8 @@ void TableScanner::print() const {
         maxsize.push_back(tableSchema.getAttrMaxSize(i));
     }
     cout<<endl;
-    badgerdb::File file = badgerdb::File::open(tableFile.filename());
+    // A full read-only scan; read the pages in place in a mapping.
+    badgerdb::File file = badgerdb::File::openMapped(tableFile.filename());
     //print tuple
     // Iterate through all pages in the file.
     for (FileIterator iter = file.begin();
@@ -44,14 +45,14 @@ void TableScanner::print() const {
          ++iter) {
       // Iterate through all records on the page.
         SlotId num = 0;
-        Page p = *iter;
-        PageId a = p.page_number();
-        for(auto left_key : *iter){
+        const Page* p = iter.view();
+        PageId a = p->page_number();
+        for(auto left_key : *p){
             num++;
             const RecordId& record = {a, num};
             //string op
             int index = 8;//head
-            string tup = /**page_iter;*/p.getRecord(record);
+            string tup = /**page_iter;*/p->getRecord(record);
             string result = "";
             for(unsigned int j = 0; j < dataType.size(); j++){
                 if(dataType[j] == 0){ //INT
@@ -87,7 +88,7 @@ void TableScanner::print() const {
                     index += maxsize[j] + 4 - (maxsize[j] % 4);
             }
             std::cout << "Found record: " << result
-                << " on page " << (*iter).page_number() << std::endl;
+                << " on page " << a << std::endl;
         }
     }
 }
@@ -175,6 +176,7 @@ bool OnePassJoinOperator::execute(int numAvailableBufPages, File& resultFile) {
     {
     }
     badgerdb::File create = badgerdb::File::create("create.txt");
+    bufMgr->bindFile(&create, TEMP_POOL);
     //right first sort
     //badgerdb::File file = badgerdb::File::open(catalog->getTableFilename(catalog->getTableId("s")));
     badgerdb::File file = badgerdb::File::open(catalog->getTableFilename(catalog->getTableId(rightTableSchema.getTableName())));
@@ -188,9 +190,8 @@ bool OnePassJoinOperator::execute(int numAvailableBufPages, File& resultFile) {
          ++iter) {
       // Iterate through all records on the page.
             Page p = *iter;
-            Page *new_page;
             PageId pagenum = p.page_number();
-            bufMgr->readPage(&file, pagenum, new_page); // readPage first
+            PageHandle new_page = bufMgr->readPage(&file, pagenum); // readPage first
             numUsedBufPages++;
             numIOs++;
             string hashString = "";
@@ -214,24 +215,21 @@ bool OnePassJoinOperator::execute(int numAvailableBufPages, File& resultFile) {
                     }
                     // read Buffer .....
                     bool flag = false;
-                    Page *hashPage;
                     RecordId hashrecord;
                     for(unsigned int i = 0; i < bufpage.size(); i++){
-                        bufMgr->readPage(&create, bufpage[i].page_number(), hashPage);
+                        PageHandle hashPage = bufMgr->readPage(&create, bufpage[i].page_number());
                         if(hashPage->hasSpaceForRecord(hashString)){
                             flag = true;
                             hashrecord = hashPage->insertRecord(hashString);
-                            bufMgr->unPinPage(&create, bufpage[i].page_number(), true);
+                            hashPage.markDirty();
                             break;
                         }
-                        bufMgr->unPinPage(&create, bufpage[i].page_number(), false);
                     }
                     if(!flag){
                         numUsedBufPages++;
-                        PageId page_Id;
-                        bufMgr->allocPage(&create, page_Id, hashPage);
+                        PageHandle hashPage = bufMgr->allocPage(&create);
                         hashrecord = hashPage->insertRecord(hashString);
-                        bufMgr->unPinPage(&create, page_Id, true);
+                        hashPage.markDirty();
                         bufpage.push_back(*hashPage);
                     }
                 }
@@ -248,7 +246,7 @@ bool OnePassJoinOperator::execute(int numAvailableBufPages, File& resultFile) {
                     }
                 }
             }
-            bufMgr->unPinPage(&file, pagenum, false);
+            new_page.release();
             bufMgr->flushFile(&file);
             numUsedBufPages--;
         }
@@ -259,6 +257,7 @@ bool OnePassJoinOperator::execute(int numAvailableBufPages, File& resultFile) {
     for(unsigned int i = 0; i < bufpage.size(); i++){
         bufMgr->disposePage(&create, bufpage[i].page_number());
     }
+    bufMgr->unbindFile(&create);
     bufMgr->flushFile(&resultFile);
     numUsedBufPages++;
     isComplete = true;
@@ -350,6 +349,8 @@ bool NestedLoopJoinOperator::execute(int numAvailableBufPages, File& resultFile)
     int read_page_num = 0;
     int usedPageNum = 0;
     int sum =  0;
+    // The left table is streamed once per block; keep it off the hot pages.
+    BufferRing* leftRing = bufMgr->openStrategy(STRATEGY_BULK_READ);
     for (FileIterator iter = rightfile.begin();
          iter != rightfile.end();
          ++iter){
@@ -398,7 +399,7 @@ bool NestedLoopJoinOperator::execute(int numAvailableBufPages, File& resultFile)
         Page *left_new_page;
         Page p = *iter;
         PageId leftPagenum = p.page_number();
-        bufMgr->readPage(&leftfile, leftPagenum, left_new_page);
+        bufMgr->readPage(&leftfile, leftPagenum, left_new_page, leftRing);
         p = *left_new_page;
         numUsedBufPages++;
         numIOs++;
@@ -428,6 +429,7 @@ bool NestedLoopJoinOperator::execute(int numAvailableBufPages, File& resultFile)
     already_in_buf.clear();
     read_page_num = 0;
     }
+    bufMgr->closeStrategy(leftRing);
     numUsedBufPages++;
     isComplete = true;
     return true;
@@ -478,6 +480,7 @@ bool GraceHashJoinOperator ::execute(int numAvailableBufPages, File& resultFile)
         {
         }
         badgerdb::File *create = new File("create"+ to_string(i), true);// create right page for every runs
+        bufMgr->bindFile(create, TEMP_POOL);
         //badgerdb::File create1 = badgerdb::File::create("create"+ to_string(i + 2));
 
         //create = File::open("create"+ to_string(i));
@@ -498,9 +501,8 @@ bool GraceHashJoinOperator ::execute(int numAvailableBufPages, File& resultFile)
          ++iter) {
       // Iterate through all records on the page.
             Page p = *iter;
-            Page *new_page;
             PageId pagenum = p.page_number();
-            bufMgr->readPage(&file, pagenum, new_page); // readPage first
+            PageHandle new_page = bufMgr->readPage(&file, pagenum); // readPage first
             numUsedBufPages++;
             numIOs++;
             string hashString = "";
@@ -523,7 +525,7 @@ bool GraceHashJoinOperator ::execute(int numAvailableBufPages, File& resultFile)
                     leftFile[numID].writePage(left_bufpage[numID]);
                 }
             }
-            bufMgr->unPinPage(&file, pagenum, false);
+            new_page.release();
             bufMgr->flushFile(&file);
             numUsedBufPages--;
         }
@@ -557,6 +559,7 @@ bool GraceHashJoinOperator ::execute(int numAvailableBufPages, File& resultFile)
                 {
                 }
                 badgerdb::File *save = new File("save"+to_string(i), true);// create right page for every runs
+                bufMgr->bindFile(save, TEMP_POOL);
                 bufMgr->allocPage(save, pageId, page);
                 left_bufpage.push_back(*page);
                 leftFile.push_back(*save);
@@ -601,6 +604,10 @@ bool GraceHashJoinOperator ::execute(int numAvailableBufPages, File& resultFile)
     }
     //File::remove("leftFile");
     //File::remove("rightFile");
+    for(int i = 0; i < numBuckets; i++){
+        bufMgr->unbindFile(&rightFile[i]);
+        bufMgr->unbindFile(&leftFile[i]);
+    }
     File refile = badgerdb::File::open(resultFile.filename());
     for (FileIterator iter = refile.begin();
          iter != refile.end();
@@ -19,6 +19,13 @@ using namespace std;
 
 namespace badgerdb {
 
+/**
+ * Name of the buffer pool the join operators bind their temporary files to.
+ * If the buffer manager has no pool of this name, temporary files share the
+ * pool with the tables.
+ */
+const char* const TEMP_POOL = "temp";
+
 /**
  * Table scanner
  */
@@ -7,23 +7,35 @@
 
 #include "file.h"
 
-#include <fstream>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 #include <cstdio>
+#include <cstring>
 #include <cassert>
 
 #include "exceptions/file_exists_exception.h"
+#include "exceptions/file_io_exception.h"
 #include "exceptions/file_not_found_exception.h"
 #include "exceptions/file_open_exception.h"
 #include "exceptions/invalid_page_exception.h"
 #include "file_iterator.h"
+#include "io_engine.h"
 #include "page.h"
 
 namespace badgerdb {
 
-File::StreamMap File::open_streams_;
+File::DescriptorMap File::open_files_;
 File::CountMap File::open_counts_;
 
 File File::create(const std::string& filename) {
@@ -34,6 +46,12 @@ File File::open(const std::string& filename) {
   return File(filename, false /* create_new */);
 }
 
+File File::openMapped(const std::string& filename) {
+  File file(filename, false /* create_new */);
+  file.map();
+  return file;
+}
+
 void File::remove(const std::string& filename) {
   if (!exists(filename)) {
     throw FileNotFoundException(filename);
@@ -52,19 +70,14 @@ bool File::isOpen(const std::string& filename) {
 }
 
 bool File::exists(const std::string& filename) {
-	std::fstream file(filename);
-	if(file)
-	{
-		file.close();
-		return true;
-	}
-
-	return false;
+	struct stat st;
+	return stat(filename.c_str(), &st) == 0;
 }
 
 File::File(const File& other)
   : filename_(other.filename_),
-    stream_(open_streams_[filename_]) {
+    descriptor_(open_files_[filename_]),
+    mapped_(other.mapped_) {
   ++open_counts_[filename_];
 }
 
@@ -74,6 +87,7 @@ File& File::operator=(const File& rhs) {
   close();	//close my file and associate me with the new one
   filename_ = rhs.filename_;
   openIfNeeded(false /* create_new */);
+  mapped_ = rhs.mapped_;
   return *this;
 }
 
@@ -82,145 +96,290 @@ File::~File() {
 }
 
 Page File::allocatePage() {
-  FileHeader header = readHeader();
   Page new_page;
-  Page existing_page;
+  allocatePage(new_page);
+  return new_page;
+}
+
+void File::allocatePage(Page& new_page) {
+  checkWritable();
+  FileHeader header = readHeader();
+  loadFreeRuns(header);
+  // Used page the new page is linked after, if any.
+  PageId previous = Page::INVALID_NUMBER;
+  PageHeader previous_header;
   if (header.num_free_pages > 0) {
-    new_page = readPage(header.first_free_page, true /* allow_free */);
+    readPage(header.first_free_page, true /* allow_free */, new_page);
     new_page.set_page_number(header.first_free_page);
     header.first_free_page = new_page.next_page_number();
     --header.num_free_pages;
+    markUsed(new_page.page_number());
 
     if (header.first_used_page == Page::INVALID_NUMBER ||
         header.first_used_page > new_page.page_number()) {
       // Either have no pages used or the head of the used list is a page later
       // than the one we just allocated, so add the new page to the head.
-      if (header.first_used_page > new_page.page_number()) {
-        new_page.set_next_page_number(header.first_used_page);
-      }
+      new_page.set_next_page_number(header.first_used_page);
       header.first_used_page = new_page.page_number();
     } else {
-      // New page is reused from somewhere after the beginning, so we need to
-      // find where in the used list to insert it.
-      PageId next_page_number = Page::INVALID_NUMBER;
-      for (FileIterator iter = begin(); iter != end(); ++iter) {
-        next_page_number = (*iter).next_page_number();
-        if (next_page_number > new_page.page_number() ||
-            next_page_number == Page::INVALID_NUMBER) {
-          existing_page = *iter;
-          break;
-        }
-      }
-      existing_page.set_next_page_number(new_page.page_number());
-      new_page.set_next_page_number(next_page_number);
+      // New page is reused from somewhere after the beginning; link it after
+      // the closest used page below it.
+      previous = usedPageBefore(new_page.page_number());
+      previous_header = readPageHeader(previous);
+      new_page.set_next_page_number(previous_header.next_page_number);
+      previous_header.next_page_number = new_page.page_number();
     }
 
     assert((header.num_free_pages == 0) ==
            (header.first_free_page == Page::INVALID_NUMBER));
   } else {
+    new_page.initialize();
     new_page.set_page_number(header.num_pages);
     if (header.first_used_page == Page::INVALID_NUMBER) {
       header.first_used_page = new_page.page_number();
     } else {
-      // If we have pages allocated, we need to add the new page to the tail
-      // of the linked list.
-      for (FileIterator iter = begin(); iter != end(); ++iter) {
-        if ((*iter).next_page_number() == Page::INVALID_NUMBER) {
-          existing_page = *iter;
-          break;
-        }
-      }
-      assert(existing_page.isUsed());
-      existing_page.set_next_page_number(new_page.page_number());
+      // If we have pages allocated, add the new page after the tail of the
+      // used list, the highest used page.
+      previous = usedPageBefore(new_page.page_number());
+      previous_header = readPageHeader(previous);
+      assert(previous_header.next_page_number == Page::INVALID_NUMBER);
+      previous_header.next_page_number = new_page.page_number();
     }
     ++header.num_pages;
   }
   writePage(new_page.page_number(), new_page);
-  if (existing_page.page_number() != Page::INVALID_NUMBER) {
+  if (previous != Page::INVALID_NUMBER) {
     // If we updated an existing page by inserting the new page into the
-    // used list, we need to write it out.
-    writePage(existing_page.page_number(), existing_page);
+    // used list, we need to write its header out.
+    writePageHeader(previous, previous_header);
   }
   writeHeader(header);
-
-  return new_page;
 }
 
 Page File::readPage(const PageId page_number) const {
-  FileHeader header = readHeader();
-  if (page_number >= header.num_pages) {
+  if (page_number >= numPages()) {
     throw InvalidPageException(page_number, filename_);
   }
   return readPage(page_number, false /* allow_free */);
 }
 
+void File::readPage(const PageId page_number, Page& page) const {
+  if (page_number >= numPages()) {
+    throw InvalidPageException(page_number, filename_);
+  }
+  readPage(page_number, false /* allow_free */, page);
+}
+
 Page File::readPage(const PageId page_number, const bool allow_free) const {
   Page page;
-  stream_->seekg(pagePosition(page_number), std::ios::beg);
-  stream_->read(reinterpret_cast<char*>(&page.header_), sizeof(page.header_));
-  stream_->read(reinterpret_cast<char*>(&page.data_[0]), Page::DATA_SIZE);
+  readPage(page_number, allow_free, page);
+  return page;
+}
+
+void File::readPage(const PageId page_number, const bool allow_free,
+                    Page& page) const {
+  const char* view = mappedAt(pagePosition(page_number), Page::SIZE);
+  if (view != NULL) {
+    std::memcpy(static_cast<void*>(&page), view, Page::SIZE);
+  } else {
+    readAt(&page, Page::SIZE, pagePosition(page_number));
+  }
   if (!allow_free && !page.isUsed()) {
     throw InvalidPageException(page_number, filename_);
   }
-
-  return page;
 }
 
 void File::writePage(const Page& new_page) {
-  PageHeader header = readPageHeader(new_page.page_number());
-  if (header.current_page_number == Page::INVALID_NUMBER) {
-    // Page has been deleted since it was read.
-    throw InvalidPageException(new_page.page_number(), filename_);
+  checkWritable();
+  writePage(new_page.page_number(), headerForWrite(new_page), new_page);
+}
+
+void File::writePages(const Page* const* pages, const std::size_t count) {
+  checkWritable();
+  if (count == 0) {
+    return;
+  }
+  // Check every page before writing any, so a deleted page leaves the whole
+  // run unwritten.
+  std::vector<PageHeader> headers;
+  headers.reserve(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    headers.push_back(headerForWrite(*pages[i]));
+  }
+  // Gather the run into as few pwritev() calls as IOV_MAX allows.
+  const std::size_t per_call = IOV_MAX / 2;
+  std::vector<iovec> iov;
+  iov.reserve(2 * std::min(count, per_call));
+  for (std::size_t start = 0; start < count; start += per_call) {
+    const std::size_t end = std::min(count, start + per_call);
+    iov.clear();
+    for (std::size_t i = start; i < end; ++i) {
+      iovec header_vec = {&headers[i], sizeof(headers[i])};
+      iovec data_vec = {const_cast<char*>(pages[i]->data_), Page::DATA_SIZE};
+      iov.push_back(header_vec);
+      iov.push_back(data_vec);
+    }
+    writeAt(&iov[0], static_cast<int>(iov.size()),
+            pagePosition(pages[start]->page_number()));
   }
-  // Page on disk may have had its next page pointer updated since it was read;
-  // we don't modify that, but we do keep all the other modifications to the
-  // page header.
-  const PageId next_page_number = header.next_page_number;
-  header = new_page.header_;
-  header.next_page_number = next_page_number;
-  writePage(new_page.page_number(), header, new_page);
+}
+
+void File::readPageAsync(
+    IoEngine& engine, const PageId page_number, Page& page,
+    const std::function<void(std::exception_ptr)>& done) const {
+  if (page_number >= numPages()) {
+    throw InvalidPageException(page_number, filename_);
+  }
+  const char* view = mappedAt(pagePosition(page_number), Page::SIZE);
+  if (view != NULL) {
+    std::memcpy(static_cast<void*>(&page), view, Page::SIZE);
+    done(page.isUsed() ? std::exception_ptr()
+                       : std::make_exception_ptr(
+                             InvalidPageException(page_number, filename_)));
+    return;
+  }
+  IoRequest* request = new IoRequest;
+  request->op = IoRequest::READ;
+  request->fd = descriptor_->fd;
+  request->offset = pagePosition(page_number);
+  iovec iov = {&page, Page::SIZE};
+  request->iov.push_back(iov);
+  const File* self = this;
+  Page* target = &page;
+  request->done = [self, page_number, target, done](const ssize_t result) {
+    std::exception_ptr error;
+    try {
+      if (result < 0) {
+        throw FileIOException(self->filename_, static_cast<int>(-result));
+      }
+      if (static_cast<std::size_t>(result) < Page::SIZE) {
+        // Short read: finish it here, reading zeroes past the end.
+        self->readAt(reinterpret_cast<char*>(target) + result,
+                     Page::SIZE - result, pagePosition(page_number) + result);
+      }
+      if (!target->isUsed()) {
+        throw InvalidPageException(page_number, self->filename_);
+      }
+    } catch (...) {
+      error = std::current_exception();
+    }
+    done(error);
+  };
+  engine.submit(request);
+}
+
+void File::writePagesAsync(
+    IoEngine& engine, const Page* const* pages, const std::size_t count,
+    const std::function<void(std::exception_ptr)>& done) {
+  checkWritable();
+  if (count == 0) {
+    done(std::exception_ptr());
+    return;
+  }
+  // Headers are checked and built up front, as in writePages(), and live
+  // until the last request is done.
+  std::shared_ptr<std::vector<PageHeader> > headers(
+      new std::vector<PageHeader>());
+  headers->reserve(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    headers->push_back(headerForWrite(*pages[i]));
+  }
+
+  struct Batch {
+    std::atomic<std::size_t> remaining;
+    std::mutex latch;
+    std::exception_ptr error;
+  };
+  const std::size_t per_request = IOV_MAX / 2;
+  std::shared_ptr<Batch> batch(new Batch);
+  batch->remaining = (count + per_request - 1) / per_request;
+
+  std::vector<IoRequest*> requests;
+  for (std::size_t start = 0; start < count; start += per_request) {
+    const std::size_t end = std::min(count, start + per_request);
+    IoRequest* request = new IoRequest;
+    request->op = IoRequest::WRITE;
+    request->fd = descriptor_->fd;
+    request->offset = pagePosition(pages[start]->page_number());
+    for (std::size_t i = start; i < end; ++i) {
+      iovec header_vec = {&(*headers)[i], sizeof(PageHeader)};
+      iovec data_vec = {const_cast<char*>(pages[i]->data_), Page::DATA_SIZE};
+      request->iov.push_back(header_vec);
+      request->iov.push_back(data_vec);
+    }
+    const File* self = this;
+    const std::vector<iovec> iov = request->iov;
+    const off_t offset = request->offset;
+    request->done = [self, headers, batch, iov, offset, done](
+        const ssize_t result) {
+      try {
+        if (result < 0) {
+          throw FileIOException(self->filename_, static_cast<int>(-result));
+        }
+        // Short write: write the rest here.
+        std::vector<iovec> rest(iov);
+        iovec* next = &rest[0];
+        int left = static_cast<int>(rest.size());
+        skipBytes(next, left, result);
+        if (left > 0) {
+          self->writeAt(next, left, offset + result);
+        }
+      } catch (...) {
+        std::lock_guard<std::mutex> guard(batch->latch);
+        if (!batch->error) {
+          batch->error = std::current_exception();
+        }
+      }
+      if (--batch->remaining == 0) {
+        done(batch->error);
+      }
+    };
+    requests.push_back(request);
+  }
+  engine.submit(&requests[0], requests.size());
 }
 
 void File::deletePage(const PageId page_number) {
+  checkWritable();
   FileHeader header = readHeader();
+  loadFreeRuns(header);
   Page existing_page = readPage(page_number);
-  Page previous_page;
   // If this page is the head of the used list, update the header to point to
-  // the next page in line.
-  if (page_number == header.first_used_page) {
+  // the next page in line; otherwise update the page before it.
+  const PageId previous = page_number == header.first_used_page
+                              ? Page::INVALID_NUMBER
+                              : usedPageBefore(page_number);
+  if (previous == Page::INVALID_NUMBER) {
     header.first_used_page = existing_page.next_page_number();
   } else {
-    // Walk the used list so we can update the page that points to this one.
-    for (FileIterator iter = begin(); iter != end(); ++iter) {
-      previous_page = *iter;
-      if (previous_page.next_page_number() == existing_page.page_number()) {
-        previous_page.set_next_page_number(existing_page.next_page_number());
-        break;
-      }
-    }
+    PageHeader previous_header = readPageHeader(previous);
+    previous_header.next_page_number = existing_page.next_page_number();
+    writePageHeader(previous, previous_header);
   }
   // Clear the page and add it to the head of the free list.
   existing_page.initialize();
   existing_page.set_next_page_number(header.first_free_page);
   header.first_free_page = page_number;
   ++header.num_free_pages;
-  if (previous_page.isUsed()) {
-    writePage(previous_page.page_number(), previous_page);
-  }
+  markFree(page_number);
   writePage(page_number, existing_page);
   writeHeader(header);
 }
 
 FileIterator File::begin() {
-  const FileHeader& header = readHeader();
-  return FileIterator(this, header.first_used_page);
+  if (mapped_ && descriptor_->map_base != NULL) {
+    madvise(const_cast<char*>(descriptor_->map_base),
+            descriptor_->map_length, MADV_SEQUENTIAL);
+  }
+  return FileIterator(this, firstUsedPage());
 }
 
 FileIterator File::end() {
   return FileIterator(this, Page::INVALID_NUMBER);
 }
 
-File::File(const std::string& name, const bool create_new) : filename_(name) {
+File::File(const std::string& name, const bool create_new)
+    : filename_(name), mapped_(false) {
   openIfNeeded(create_new);
 
   if (create_new) {
@@ -234,72 +393,373 @@ File::File(const std::string& name, const bool create_new) : filename_(name) {
 void File::openIfNeeded(const bool create_new) {
   if (open_counts_.find(filename_) != open_counts_.end()) {	//exists an entry already
     ++open_counts_[filename_];
-    stream_ = open_streams_[filename_];
+    descriptor_ = open_files_[filename_];
   } else {
-    std::ios_base::openmode mode =
-        std::fstream::in | std::fstream::out | std::fstream::binary;
+    int flags = O_RDWR;
     const bool already_exists = exists(filename_);
     if (create_new) {
       // Error if we try to overwrite an existing file.
       if (already_exists) {
         throw FileExistsException(filename_);
       }
-      // New files have to be truncated on open.
-      mode = mode | std::fstream::trunc;
+      // New files have to be created, and truncated should one appear
+      // meanwhile.
+      flags |= O_CREAT | O_TRUNC;
     } else {
       // Error if we try to open a file that doesn't exist.
       if (!already_exists) {
         throw FileNotFoundException(filename_);
       }
     }
-    stream_.reset(new std::fstream(filename_, mode));
-    open_streams_[filename_] = stream_;
+    const int fd = ::open(filename_.c_str(), flags, 0644);
+    if (fd < 0) {
+      throw FileIOException(filename_, errno);
+    }
+    descriptor_.reset(new Descriptor(fd));
+    if (!create_new) {
+      FileHeader& header = descriptor_->header;
+      readAt(&header, sizeof(header), 0 /* offset */);
+      descriptor_->num_pages.store(header.num_pages);
+      descriptor_->first_used_page.store(header.first_used_page);
+    }
+    open_files_[filename_] = descriptor_;
     open_counts_[filename_] = 1;
   }
 }
 
 void File::close() {
   --open_counts_[filename_];
-  stream_.reset();
+  descriptor_.reset();
   if (open_counts_[filename_] == 0) {
-    open_streams_.erase(filename_);
+    open_files_.erase(filename_);
     open_counts_.erase(filename_);
   }
 }
 
 void File::writePage(const PageId page_number, const Page& new_page) {
-  writePage(page_number, new_page.header_, new_page);
+  iovec iov = {const_cast<Page*>(&new_page), Page::SIZE};
+  writeAt(&iov, 1, pagePosition(page_number));
 }
 
 void File::writePage(const PageId page_number, const PageHeader& header,
                      const Page& new_page) {
-  stream_->seekp(pagePosition(page_number), std::ios::beg);
-  stream_->write(reinterpret_cast<const char*>(&header), sizeof(header));
-  stream_->write(reinterpret_cast<const char*>(&new_page.data_[0]),
-                 Page::DATA_SIZE);
-  stream_->flush();
+  iovec iov[2] = {{const_cast<PageHeader*>(&header), sizeof(header)},
+                  {const_cast<char*>(new_page.data_), Page::DATA_SIZE}};
+  writeAt(iov, 2, pagePosition(page_number));
 }
 
 FileHeader File::readHeader() const {
-  FileHeader header;
-  stream_->seekg(0 /* pos */, std::ios::beg);
-  stream_->read(reinterpret_cast<char*>(&header), sizeof(header));
-
-  return header;
+  std::lock_guard<std::mutex> guard(descriptor_->latch);
+  return descriptor_->header;
 }
 
 void File::writeHeader(const FileHeader& header) {
-  stream_->seekp(0 /* pos */, std::ios::beg);
-  stream_->write(reinterpret_cast<const char*>(&header), sizeof(header));
-  stream_->flush();
+  std::lock_guard<std::mutex> guard(descriptor_->latch);
+  descriptor_->header = header;
+  descriptor_->header_dirty = true;
+  descriptor_->num_pages.store(header.num_pages, std::memory_order_release);
+  descriptor_->first_used_page.store(header.first_used_page,
+                                     std::memory_order_release);
+}
+
+void File::sync() const {
+  SyncMode mode;
+  {
+    std::lock_guard<std::mutex> guard(descriptor_->latch);
+    if (descriptor_->header_dirty) {
+      iovec iov = {&descriptor_->header, sizeof(descriptor_->header)};
+      writeAt(&iov, 1, 0 /* offset */);
+      descriptor_->header_dirty = false;
+    }
+    mode = descriptor_->sync_mode;
+  }
+  int result = 0;
+  if (mode == SYNC_DATA) {
+    result = fdatasync(descriptor_->fd);
+  } else if (mode == SYNC_FULL) {
+    result = fsync(descriptor_->fd);
+  }
+  if (result != 0) {
+    throw FileIOException(filename_, errno);
+  }
+}
+
+void File::setSyncMode(const SyncMode mode) {
+  std::lock_guard<std::mutex> guard(descriptor_->latch);
+  descriptor_->sync_mode = mode;
+}
+
+File::SyncMode File::syncMode() const {
+  std::lock_guard<std::mutex> guard(descriptor_->latch);
+  return descriptor_->sync_mode;
+}
+
+void* File::ownerSlot(const std::uint64_t owner) const {
+  for (int i = 0; i < OWNER_SLOTS; ++i) {
+    const OwnerSlot& entry = descriptor_->owner_slots[i];
+    if (entry.owner.load(std::memory_order_acquire) != owner) {
+      continue;
+    }
+    // The entry may be handed to another owner meanwhile; the slot read is
+    // ours only if the entry still belongs to owner afterwards.
+    void* const slot = entry.slot.load(std::memory_order_acquire);
+    if (entry.owner.load(std::memory_order_relaxed) == owner) {
+      return slot;
+    }
+  }
+  return NULL;
+}
+
+void File::setOwnerSlot(const std::uint64_t owner, void* slot) const {
+  std::lock_guard<std::mutex> guard(descriptor_->latch);
+  int chosen = -1;
+  for (int i = 0; i < OWNER_SLOTS; ++i) {
+    const std::uint64_t current = descriptor_->owner_slots[i].owner.load();
+    if (current == owner) {
+      chosen = i;
+      break;
+    }
+    if (current == 0 && chosen < 0) {
+      chosen = i;
+    }
+  }
+  if (chosen < 0) {
+    chosen = descriptor_->next_owner_slot;
+    descriptor_->next_owner_slot = (chosen + 1) % OWNER_SLOTS;
+  }
+  OwnerSlot& entry = descriptor_->owner_slots[chosen];
+  // Release the entry before changing the slot, so that no reader pairs
+  // the slot with the wrong owner.
+  entry.owner.store(0, std::memory_order_relaxed);
+  entry.slot.store(slot, std::memory_order_release);
+  entry.owner.store(owner, std::memory_order_release);
+}
+
+PageHeader File::headerForWrite(const Page& new_page) const {
+  PageHeader header = readPageHeader(new_page.page_number());
+  if (header.current_page_number == Page::INVALID_NUMBER) {
+    // Page has been deleted since it was read.
+    throw InvalidPageException(new_page.page_number(), filename_);
+  }
+  // Page on disk may have had its next page pointer updated since it was read;
+  // we don't modify that, but we do keep all the other modifications to the
+  // page header.
+  const PageId next_page_number = header.next_page_number;
+  header = new_page.header_;
+  header.next_page_number = next_page_number;
+  return header;
 }
 
 PageHeader File::readPageHeader(PageId page_number) const {
   PageHeader header;
-  stream_->seekg(pagePosition(page_number), std::ios::beg);
-  stream_->read(reinterpret_cast<char*>(&header), sizeof(header));
+  const char* view = mappedAt(pagePosition(page_number), sizeof(header));
+  if (view != NULL) {
+    std::memcpy(&header, view, sizeof(header));
+  } else {
+    readAt(&header, sizeof(header), pagePosition(page_number));
+  }
 
   return header;
 }
 
+void File::writePageHeader(const PageId page_number,
+                           const PageHeader& header) {
+  iovec iov = {const_cast<PageHeader*>(&header), sizeof(header)};
+  writeAt(&iov, 1, pagePosition(page_number));
+}
+
+PageId File::usedPageBefore(const PageId page_number) const {
+  const std::map<PageId, PageId>& runs = descriptor_->free_runs;
+  // Run starting at or below the page before, if any.
+  std::map<PageId, PageId>::const_iterator run =
+      runs.upper_bound(page_number - 1);
+  if (run == runs.begin()) {
+    return page_number - 1;
+  }
+  --run;
+  if (run->second >= page_number - 1) {
+    // The page before is free; so is every page down to the run's start.
+    return run->first - 1;
+  }
+  return page_number - 1;
+}
+
+void File::loadFreeRuns(const FileHeader& header) const {
+  if (descriptor_->free_runs_loaded) {
+    return;
+  }
+  File* self = const_cast<File*>(this);
+  for (PageId free_page = header.first_free_page;
+       free_page != Page::INVALID_NUMBER;
+       free_page = readPageHeader(free_page).next_page_number) {
+    self->markFree(free_page);
+  }
+  descriptor_->free_runs_loaded = true;
+}
+
+void File::markFree(const PageId page_number) {
+  std::map<PageId, PageId>& runs = descriptor_->free_runs;
+  PageId first = page_number;
+  PageId last = page_number;
+  std::map<PageId, PageId>::iterator after = runs.find(page_number + 1);
+  if (after != runs.end()) {
+    last = after->second;
+    runs.erase(after);
+  }
+  std::map<PageId, PageId>::iterator before = runs.lower_bound(page_number);
+  if (before != runs.begin()) {
+    --before;
+    if (before->second + 1 == page_number) {
+      first = before->first;
+    }
+  }
+  runs[first] = last;
+}
+
+void File::markUsed(const PageId page_number) {
+  std::map<PageId, PageId>& runs = descriptor_->free_runs;
+  std::map<PageId, PageId>::iterator run = runs.upper_bound(page_number);
+  if (run == runs.begin()) {
+    return;
+  }
+  --run;
+  const PageId first = run->first;
+  const PageId last = run->second;
+  if (last < page_number) {
+    return;
+  }
+  // Split the run around the page.
+  runs.erase(run);
+  if (first < page_number) {
+    runs[first] = page_number - 1;
+  }
+  if (page_number < last) {
+    runs[page_number + 1] = last;
+  }
+}
+
+const Page* File::pageView(const PageId page_number) const {
+  const char* view = page_number == Page::INVALID_NUMBER
+                         ? NULL
+                         : mappedAt(pagePosition(page_number), Page::SIZE);
+  if (view == NULL) {
+    throw InvalidPageException(page_number, filename_);
+  }
+  const Page* page = reinterpret_cast<const Page*>(view);
+  if (!page->isUsed()) {
+    throw InvalidPageException(page_number, filename_);
+  }
+  return page;
+}
+
+void File::map() {
+  mapped_ = true;
+  struct stat st;
+  if (fstat(descriptor_->fd, &st) != 0) {
+    throw FileIOException(filename_, errno);
+  }
+  const std::size_t length = st.st_size;
+  if (length <= descriptor_->map_length) {
+    return;
+  }
+  void* base = mmap(NULL, length, PROT_READ, MAP_SHARED, descriptor_->fd, 0);
+  if (base == MAP_FAILED) {
+    throw FileIOException(filename_, errno);
+  }
+  if (descriptor_->map_base != NULL) {
+    // Views into the old mapping may still be held.
+    descriptor_->retired_maps.push_back(
+        std::make_pair(descriptor_->map_base, descriptor_->map_length));
+  }
+  descriptor_->map_base = static_cast<const char*>(base);
+  descriptor_->map_length = length;
+}
+
+const char* File::mappedAt(const off_t offset, const std::size_t count) const {
+  if (!mapped_ || offset < 0 ||
+      static_cast<std::size_t>(offset) + count > descriptor_->map_length) {
+    return NULL;
+  }
+  return descriptor_->map_base + offset;
+}
+
+void File::checkWritable() const {
+  if (mapped_) {
+    throw FileIOException(filename_, EBADF);
+  }
+}
+
+void File::readAt(void* buf, const std::size_t count,
+                  const off_t offset) const {
+  char* out = static_cast<char*>(buf);
+  std::size_t done = 0;
+  while (done < count) {
+    const ssize_t n =
+        pread(descriptor_->fd, out + done, count - done, offset + done);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw FileIOException(filename_, errno);
+    }
+    if (n == 0) {
+      // End of file.
+      std::fill(out + done, out + count, 0);
+      return;
+    }
+    done += n;
+  }
+}
+
+void File::writeAt(iovec* iov, int iovcnt, off_t offset) const {
+  while (iovcnt > 0) {
+    ssize_t n = pwritev(descriptor_->fd, iov, iovcnt, offset);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw FileIOException(filename_, errno);
+    }
+    offset += n;
+    skipBytes(iov, iovcnt, n);
+  }
+}
+
+void File::skipBytes(iovec*& iov, int& iovcnt, std::size_t count) {
+  while (iovcnt > 0 && count >= iov->iov_len) {
+    count -= iov->iov_len;
+    ++iov;
+    --iovcnt;
+  }
+  if (iovcnt > 0) {
+    iov->iov_base = static_cast<char*>(iov->iov_base) + count;
+    iov->iov_len -= count;
+  }
+}
+
+File::Descriptor::~Descriptor() {
+  if (header_dirty) {
+    // Nobody is left to report a failure to; the header stays as it was.
+    const char* out = reinterpret_cast<const char*>(&header);
+    std::size_t done = 0;
+    while (done < sizeof(header)) {
+      const ssize_t n = pwrite(fd, out + done, sizeof(header) - done, done);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        break;
+      }
+      done += n;
+    }
+  }
+  if (map_base != NULL) {
+    munmap(const_cast<char*>(map_base), map_length);
+  }
+  for (std::size_t i = 0; i < retired_maps.size(); ++i) {
+    munmap(const_cast<char*>(retired_maps[i].first), retired_maps[i].second);
+  }
+  ::close(fd);
+}
+
 }
@@ -7,16 +7,25 @@
 
 #pragma once
 
-#include <fstream>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
 #include <string>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
 
 #include "page.h"
 
 namespace badgerdb {
 
 class FileIterator;
+class IoEngine;
 
 /**
  * @brief Header metadata for files on disk which contain pages.
@@ -60,18 +69,38 @@ struct FileHeader {
  * @brief Class which represents a file in the filesystem containing database
  *        pages.
  *
- * The File class wraps a stream to an underlying file on disk.  Files contain
- * fixed-sized pages, and they never deallocate space (though they do reuse
- * deleted pages if possible).  If multiple File objects refer to the same
- * underlying file, they will share the stream in memory.
+ * The File class wraps a descriptor of an underlying file on disk.  Files
+ * contain fixed-sized pages, and they never deallocate space (though they do
+ * reuse deleted pages if possible).  If multiple File objects refer to the
+ * same underlying file, they will share the descriptor.
  * If a file that has already been opened (possibly by another query), then the File class
- * detects this (by looking in the open_streams_ map) and just returns a file object with
- * the already created stream for the file without actually opening the UNIX file again.
+ * detects this (by looking in the open_files_ map) and just returns a file object with
+ * the already open descriptor for the file without actually opening the UNIX file again.
  *
- * @warning This class is not threadsafe.
+ * Pages are read and written with pread() and pwrite() at their own offsets,
+ * so the descriptor carries no file position.  Writes are left to the
+ * operating system to put on disk; they are made durable only by sync().
+ * The file header is cached with the descriptor and written at sync() or
+ * when the last File object of the file is closed.
+ *
+ * A file opened with openMapped() is read-only and mapped into memory; its
+ * pages are read from the mapping without system calls.
+ *
+ * @warning This class is not threadsafe, except that readPage() may be called
+ *          by several threads at once, concurrently with writePage() and
+ *          writePages() of other pages.
  */
 class File {
  public:
+  /**
+   * @brief How sync() makes written pages durable.
+   */
+  enum SyncMode {
+    SYNC_NONE,  // write the cached header only; the OS writes back the rest
+    SYNC_DATA,  // fdatasync(), enough for the pages and the file size
+    SYNC_FULL   // fsync(), which also writes metadata such as timestamps
+  };
+
   /**
    * Creates a new file.
    *
@@ -82,16 +111,32 @@ class File {
 
   /**
    * Opens the file named fileName and returns the corresponding File object.
-	 * It first checks if the file is already open. If so, then the new File object created uses the same input-output stream to read to or write fom
+	 * It first checks if the file is already open. If so, then the new File object created uses the same descriptor to read to or write fom
 	 * that already open file. Reference count (open_counts_ static variable inside the File object) is incremented whenever an already open file is
-	 * opened again. Otherwise the UNIX file is actually opened. The fileName and the stream associated with this File object are inserted into the
-	 * open_streams_ map.
+	 * opened again. Otherwise the UNIX file is actually opened. The fileName and the descriptor associated with this File object are inserted into the
+	 * open_files_ map.
    *
    * @param filename  Name of the file.
    * @throws  FileNotFoundException   If the requested file doesn't exist.
    */
   static File open(const std::string& filename);
 
+  /**
+   * Opens the file named fileName read-only and maps it into memory, for
+   * scans that read the whole file.  readPage() and the FileIterator copy
+   * pages out of the mapping instead of reading them from the file, and
+   * pageView() returns them without copying.  Iterating from begin()
+   * advises the kernel that the mapping will be read sequentially.
+   * The mapping covers the file as it was when mapped and is shared with
+   * other mapped File objects of the file; pages allocated later are read
+   * from the file as usual until the file is mapped again.
+   *
+   * @param filename  Name of the file.
+   * @throws  FileNotFoundException   If the requested file doesn't exist.
+   * @throws  FileIOException         If the file cannot be mapped.
+   */
+  static File openMapped(const std::string& filename);
+
   /**
    * Deletes an existing file.
    *
@@ -145,6 +190,14 @@ class File {
    */
   Page allocatePage();
 
+  /**
+   * Allocates a new page in the file and builds it in the given page object,
+   * e.g. a buffer frame, instead of returning a copy.
+   *
+   * @param new_page  Receives the new page.
+   */
+  void allocatePage(Page& new_page);
+
   /**
    * Reads an existing page from the file.
    *
@@ -155,6 +208,18 @@ class File {
    */
   Page readPage(const PageId page_number) const;
 
+  /**
+   * Reads an existing page from the file straight into the given page
+   * object, e.g. a buffer frame, without any temporary page.  The contents
+   * of page are undefined if an exception is thrown.
+   *
+   * @param page_number   Number of page to read.
+   * @param page          Receives the page.
+   * @throws  InvalidPageException  If the page doesn't exist in the file or is
+   *                                not currently used.
+   */
+  void readPage(const PageId page_number, Page& page) const;
+
   /**
    * Writes a page into the file, replacing any existing contents.  The page
    * must have been already allocated in this file by a call to allocatePage().
@@ -164,6 +229,58 @@ class File {
    */
   void writePage(const Page& new_page);
 
+  /**
+   * Writes a run of pages with consecutive page numbers, in ascending order,
+   * with as few pwritev() calls as possible, so that the run reaches the
+   * disk as one sequential write.  Every page must have been allocated by
+   * allocatePage(); if any has been deleted since, nothing is written.
+   *
+   * @param pages   Pages to write; pages[i] must have the page number
+   *                pages[0]->page_number() + i.
+   * @param count   Number of pages.
+   * @throws  InvalidPageException  If a page doesn't exist in the file or is
+   *                                not currently used.
+   */
+  void writePages(const Page* const* pages, const std::size_t count);
+
+  /**
+   * Starts reading an existing page into the given page object through the
+   * engine and returns without waiting for it.  The page object and this
+   * File object must stay alive until done has been called.
+   *
+   * @param engine        Engine to run the read on.
+   * @param page_number   Number of page to read.
+   * @param page          Receives the page.
+   * @param done          Called once the read is over, on a thread of the
+   *                      engine or before returning, with a null pointer or
+   *                      the exception the read failed with, e.g.
+   *                      InvalidPageException if the page is not in use.
+   * @throws  InvalidPageException  If the page is past the end of the file;
+   *                                done is not called then.
+   */
+  void readPageAsync(IoEngine& engine, const PageId page_number, Page& page,
+                     const std::function<void(std::exception_ptr)>& done) const;
+
+  /**
+   * Starts writing a run of pages like writePages() through the engine and
+   * returns without waiting for it.  The run is split into requests of at
+   * most IOV_MAX / 2 pages that the engine may run in parallel.  The pages
+   * and this File object must stay alive until done has been called.
+   *
+   * @param engine  Engine to run the writes on.
+   * @param pages   Pages to write, as for writePages().
+   * @param count   Number of pages.
+   * @param done    Called once every request is over, on a thread of the
+   *                engine or before returning, with a null pointer or the
+   *                first exception a request failed with.
+   * @throws  InvalidPageException  If a page doesn't exist in the file or is
+   *                                not currently used; nothing is written and
+   *                                done is not called then.
+   */
+  void writePagesAsync(IoEngine& engine, const Page* const* pages,
+                       const std::size_t count,
+                       const std::function<void(std::exception_ptr)>& done);
+
   /**
    * Deletes a page from the file.
    *
@@ -171,6 +288,64 @@ class File {
    */
   void deletePage(const PageId page_number);
 
+  /**
+   * Returns true if this object was opened by openMapped(), and so may only
+   * read.
+   */
+  bool isMapped() const { return mapped_; }
+
+  /**
+   * Returns the given page as it is in the mapping, without copying it.  The
+   * page stays valid while any File object of the file is open, and shows
+   * later writes to the page by other File objects.
+   *
+   * @param page_number   Number of page to return.
+   * @return  The page in the mapping.
+   * @throws  InvalidPageException  If the page is not in the mapping or is
+   *                                not currently used.
+   */
+  const Page* pageView(const PageId page_number) const;
+
+  /**
+   * Makes every write to the file so far durable: writes the cached file
+   * header if it changed, then syncs the file as the sync mode says.
+   *
+   * @throws  FileIOException   If the write or the sync fails.
+   */
+  void sync() const;
+
+  /**
+   * Sets how sync() makes writes durable, for every File object of this
+   * file.  The default is SYNC_DATA.
+   *
+   * @param mode  New sync mode.
+   */
+  void setSyncMode(const SyncMode mode);
+
+  /**
+   * Returns how sync() makes writes durable.
+   */
+  SyncMode syncMode() const;
+
+  /**
+   * Returns the slot the given owner keeps for this file, e.g. the per-file
+   * statistics of a buffer pool.  Takes no lock.  The slots of the last few
+   * owners that set one are remembered, for every File object of this file.
+   *
+   * @param owner  Id of the owner, never reused by another owner.
+   * @return  Slot set by setOwnerSlot() for owner, or NULL.
+   */
+  void* ownerSlot(const std::uint64_t owner) const;
+
+  /**
+   * Remembers the slot the given owner keeps for this file.  If the slots
+   * of OWNER_SLOTS other owners are remembered, one of them is forgotten.
+   *
+   * @param owner  Id of the owner, never reused by another owner.
+   * @param slot   Slot to return from ownerSlot(owner).
+   */
+  void setOwnerSlot(const std::uint64_t owner, void* slot) const;
+
   /**
    * Returns the name of the file this object represents.
    *
@@ -216,7 +391,7 @@ class File {
    * @param page_number   Number of page.
    * @return  Position of page in file.
    */
-  static std::streampos pagePosition(const PageId page_number) {
+  static off_t pagePosition(const PageId page_number) {
     return sizeof(FileHeader) + ((page_number - 1) * Page::SIZE);
   }
 
@@ -225,7 +400,7 @@ class File {
   /**
    * Opens the underlying file named in filename_.
    * This method only opens the file if no other File objects exist that access
-   * the same filesystem file; otherwise, it reuses the existing stream.
+   * the same filesystem file; otherwise, it reuses the existing descriptor.
    *
    * @param create_new  Whether to create a new file.
    * @throws  FileExistsException     If the underlying file exists and
@@ -236,7 +411,7 @@ class File {
   void openIfNeeded(const bool create_new);
 
   /**
-   * Closes the underlying file stream in <stream_>.
+   * Closes the underlying file descriptor in <descriptor_>.
    * This method only closes the file if no other File objects exist that access
    * the same file.
    */
@@ -246,8 +421,8 @@ class File {
    * Reads a page from the file.  If <allow_free> is not set, an exception
    * will be thrown if the page read from disk is not currently in use.
    *
-   * No bounds checking is performed; the underlying file stream will throw
-   * an exception if the page is past the end of the file.
+   * No bounds checking is performed; a page past the end of the file reads as
+   * zeroes, and so as a free page.
    *
    * @param page_number   Number of page to read.
    * @param allow_free    Whether to allow reading a free (unused) page.
@@ -257,6 +432,17 @@ class File {
    */
   Page readPage(const PageId page_number, const bool allow_free) const;
 
+  /**
+   * Reads a page from the file into the given page object.  Throws an
+   * exception if the page is free and allow_free is false.
+   *
+   * @param page_number   Number of page to read.
+   * @param allow_free    Whether to allow reading a free (unused) page.
+   * @param page          Receives the page.
+   */
+  void readPage(const PageId page_number, const bool allow_free,
+                Page& page) const;
+
   /**
    * Writes a page into the file at the given page number.  This does not
    * update ensure that the number in the header equals the position on disk.
@@ -280,14 +466,40 @@ class File {
                  const Page& new_page);
 
   /**
-   * Reads the header for this file from disk.
+   * Returns the header to write for the given page: its own header, except
+   * for the next page pointer, which is kept as it is on disk.
+   *
+   * @param new_page  Page about to be written.
+   * @throws  InvalidPageException  If the page has been deleted.
+   */
+  PageHeader headerForWrite(const Page& new_page) const;
+
+  /**
+   * Returns the header for this file, as cached since the file was opened.
+   * Takes the descriptor latch; hot paths use numPages() and
+   * firstUsedPage() instead.
    *
    * @return  The file header.
    */
   FileHeader readHeader() const;
 
   /**
-   * Writes the given header to the disk as the header for this file.
+   * Returns the number of pages in the file, without taking a lock.
+   */
+  PageId numPages() const {
+    return descriptor_->num_pages.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Returns the first page of the used list, without taking a lock.
+   */
+  PageId firstUsedPage() const {
+    return descriptor_->first_used_page.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Sets the header for this file.  Only the cached copy changes; it is
+   * written to disk by sync() or when the file is closed.
    *
    * @param header  File header to write.
    */
@@ -302,14 +514,197 @@ class File {
    */
   PageHeader readPageHeader(const PageId page_number) const;
 
+  /**
+   * Writes only the header of the given page to disk.  No bounds checking is
+   * performed.
+   *
+   * @param page_number   Number of page whose header is to be written.
+   * @param header        Header to write.
+   */
+  void writePageHeader(const PageId page_number, const PageHeader& header);
+
+  /**
+   * Returns the used page with the highest number below the given one, which
+   * is its predecessor in the used list as the list is kept in page number
+   * order.  Every page is either used or free, so this is the page before
+   * the run of free pages just below page_number; it is found in the free
+   * runs without reading from disk.
+   *
+   * @param page_number   Number of page, at most num_pages.
+   * @return  Number of the used page, or Page::INVALID_NUMBER if there is
+   *          none.
+   */
+  PageId usedPageBefore(const PageId page_number) const;
+
+  /**
+   * Fills the free runs of the descriptor from the free list of the file,
+   * unless done before.  Reads one page header per free page, once per
+   * opening of the file.
+   *
+   * @param header  Current file header.
+   */
+  void loadFreeRuns(const FileHeader& header) const;
+
+  /**
+   * Records in the free runs that the page was freed, or taken for use.
+   *
+   * @param page_number   Number of page.
+   */
+  void markFree(const PageId page_number);
+  void markUsed(const PageId page_number);
+
+  /**
+   * Reads count bytes at the given offset into buf, retrying short reads.
+   * Bytes past the end of the file read as zeroes.
+   *
+   * @throws  FileIOException   If the read fails.
+   */
+  void readAt(void* buf, const std::size_t count, const off_t offset) const;
+
+  /**
+   * Writes the buffers described by iov at the given offset, one after
+   * another, retrying short writes.  iov is consumed.
+   *
+   * @throws  FileIOException   If the write fails.
+   */
+  void writeAt(iovec* iov, int iovcnt, off_t offset) const;
+
+  /**
+   * Advances iov past the first count bytes, dropping the buffers written
+   * in full and trimming the one written in part.
+   */
+  static void skipBytes(iovec*& iov, int& iovcnt, std::size_t count);
+
+  /**
+   * Maps the whole file into memory, unless the mapping already covers it,
+   * and marks this object as mapped.
+   *
+   * @throws  FileIOException   If the mapping fails.
+   */
+  void map();
+
+  /**
+   * Returns the count bytes at the given offset in the mapping, or NULL if
+   * this object is not mapped or the mapping ends before them.
+   */
+  const char* mappedAt(const off_t offset, const std::size_t count) const;
+
+  /**
+   * Throws if this object may only read.
+   *
+   * @throws  FileIOException   If the file was opened by openMapped().
+   */
+  void checkWritable() const;
+
+  /**
+   * Number of owners whose slots are remembered per file
+   */
+  static const int OWNER_SLOTS = 4;
+
+  /**
+   * @brief Slot of an owner, see ownerSlot().  An owner of 0 marks an
+   *        unused entry.
+   */
+  struct OwnerSlot {
+    std::atomic<std::uint64_t> owner;
+    std::atomic<void*> slot;
+  };
+
+  /**
+   * @brief Open file descriptor and the state shared by all File objects of
+   *        the file.  Closed, after writing the cached header back, when the
+   *        last File object sharing it goes away.
+   */
+  struct Descriptor {
+    explicit Descriptor(const int file_descriptor)
+        : fd(file_descriptor),
+          header_dirty(false),
+          num_pages(0),
+          first_used_page(Page::INVALID_NUMBER),
+          free_runs_loaded(false),
+          sync_mode(SYNC_DATA),
+          map_base(NULL),
+          map_length(0),
+          next_owner_slot(0) {
+      for (int i = 0; i < OWNER_SLOTS; ++i) {
+        owner_slots[i].owner = 0;
+        owner_slots[i].slot = NULL;
+      }
+    }
+    ~Descriptor();
+
+    const int fd;
+
+    /**
+     * Cached file header, read when the file is opened
+     */
+    FileHeader header;
+
+    /**
+     * True if header differs from the header on disk
+     */
+    bool header_dirty;
+
+    /**
+     * Copies of the header fields read on every page access, so that those
+     * need no lock.  Stored under latch, after the pages they cover are
+     * written.
+     */
+    std::atomic<PageId> num_pages;
+    std::atomic<PageId> first_used_page;
+
+    /**
+     * Free pages as runs of consecutive numbers, keyed by the first page of
+     * each run and holding its last, so that the used page before any page
+     * is found without reading the file.  Loaded by loadFreeRuns(); changed
+     * only by allocatePage() and deletePage(), which callers serialize like
+     * every header update.
+     */
+    std::map<PageId, PageId> free_runs;
+    bool free_runs_loaded;
+
+    SyncMode sync_mode;
+
+    /**
+     * Protects header, header_dirty, sync_mode and next_owner_slot; taken by
+     * header updates and sync(), not by page reads or writes
+     */
+    mutable std::mutex latch;
+
+    /**
+     * Read-only mapping of the file made by openMapped(), or NULL
+     */
+    const char* map_base;
+    std::size_t map_length;
+
+    /**
+     * Mappings replaced by larger ones, kept for the views handed out
+     */
+    std::vector<std::pair<const char*, std::size_t> > retired_maps;
+
+    /**
+     * Slots of the owners that set one, changed under latch
+     */
+    OwnerSlot owner_slots[OWNER_SLOTS];
+
+    /**
+     * Entry of owner_slots given to the next owner once all are in use
+     */
+    int next_owner_slot;
+
+   private:
+    Descriptor(const Descriptor&);
+    Descriptor& operator=(const Descriptor&);
+  };
+
   typedef std::map<std::string,
-                   std::shared_ptr<std::fstream> > StreamMap;
+                   std::shared_ptr<Descriptor> > DescriptorMap;
   typedef std::map<std::string, int> CountMap;
 
   /**
-   * Streams for opened files.
+   * Descriptors for opened files.
    */
-  static StreamMap open_streams_;
+  static DescriptorMap open_files_;
 
   /**
    * Counts for opened files.
@@ -322,9 +717,14 @@ class File {
   std::string filename_;
 
   /**
-   * Stream for underlying filesystem object.
+   * Descriptor for underlying filesystem object.
+   */
+  std::shared_ptr<Descriptor> descriptor_;
+
+  /**
+   * True if this object was opened by openMapped()
    */
-  std::shared_ptr<std::fstream> stream_;
+  bool mapped_;
 
   friend class FileIterator;
   friend class FileTest;
@@ -39,8 +39,7 @@ class FileIterator {
   FileIterator(File* file)
       : file_(file) {
     assert(file_ != NULL);
-    const FileHeader& header = file_->readHeader();
-    current_page_number_ = header.first_used_page;
+    current_page_number_ = file_->firstUsedPage();
   }
 
   /**
@@ -103,6 +102,16 @@ class FileIterator {
 	inline Page operator*() const
   { return file_->readPage(current_page_number_); }
 
+  /**
+   * Returns the current page as it is in the mapping of a file opened by
+   * File::openMapped(), without copying it.
+   *
+   * @return  Page in the mapping.
+   * @throws  InvalidPageException  If the page is not in the mapping.
+   */
+  inline const Page* view() const
+  { return file_->pageView(current_page_number_); }
+
  private:
   /**
    * File we're iterating over.
@@ -0,0 +1,218 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <sys/mman.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include "types.h"
+
+namespace badgerdb {
+
+/**
+ * @brief Array indexed by frame number that grows and shrinks in chunks.
+ *
+ * Elements are allocated CHUNK_FRAMES at a time and never move, so pointers
+ * to them stay valid while the buffer pool is resized.  The chunk directory
+ * is allocated once, so indexing takes no latch; grow() and shrink() must be
+ * serialized by the caller and must not remove elements still in use.
+ *
+ * Chunks come from the heap, or are mapped from the kernel one by one.
+ * Mapped chunks are aligned to and sized in huge pages and advised to be
+ * backed by them, so that a chunk of pages costs a single TLB entry.
+ */
+template <class T>
+class FrameArray {
+ public:
+  /**
+   * log2 of the number of elements per chunk; 256 pages make 2 MiB
+   */
+  static const std::uint32_t CHUNK_SHIFT = 8;
+
+  /**
+   * Number of elements per chunk
+   */
+  static const std::uint32_t CHUNK_FRAMES = 1u << CHUNK_SHIFT;
+
+  /**
+   * Number of chunks the directory has room for
+   */
+  static const std::uint32_t MAX_CHUNKS = 4096;
+
+  /**
+   * Number of elements the array can hold
+   */
+  static const std::uint32_t MAX_FRAMES = MAX_CHUNKS * CHUNK_FRAMES;
+
+  /**
+   * Size of a transparent huge page
+   */
+  static const std::size_t HUGE_PAGE_SIZE = 2 << 20;
+
+  /**
+   * Constructs an empty array.
+   *
+   * @param alignment  Alignment of every chunk, a power of two
+   * @param mapped     Map chunks from the kernel and back them with huge
+   *                   pages where possible, instead of taking them from
+   *                   the heap
+   * @param prefault   Touch every mapped chunk when it is allocated, so
+   *                   that first accesses to elements do not fault
+   */
+  explicit FrameArray(const std::size_t alignment, const bool mapped = false,
+                      const bool prefault = false)
+      : alignment_(alignment),
+        mapped_(mapped),
+        prefault_(prefault),
+        chunks_(new T*[MAX_CHUNKS]()),
+        num_chunks_(0) {
+  }
+
+  /**
+   * Destroys all elements.
+   */
+  ~FrameArray() {
+    shrink(0);
+    delete [] chunks_;
+  }
+
+  /**
+   * Returns the element of the given frame, which must be below capacity().
+   */
+  T& operator[](const FrameId frame) const {
+    return chunks_[frame >> CHUNK_SHIFT][frame & (CHUNK_FRAMES - 1)];
+  }
+
+  /**
+   * Returns the number of elements in the allocated chunks.
+   */
+  std::uint32_t capacity() const {
+    return num_chunks_ * CHUNK_FRAMES;
+  }
+
+  /**
+   * Allocates and default-constructs chunks until capacity() is at least
+   * frames.
+   *
+   * @param frames  Number of elements needed
+   * @throws std::bad_alloc  If out of memory or chunks
+   */
+  void grow(const std::uint32_t frames) {
+    while (capacity() < frames) {
+      void* block = num_chunks_ == MAX_CHUNKS ? NULL : allocChunk();
+      if (block == NULL) {
+        throw std::bad_alloc();
+      }
+      T* chunk = static_cast<T*>(block);
+      for (std::uint32_t i = 0; i < CHUNK_FRAMES; i++) {
+        new (&chunk[i]) T();
+      }
+      chunks_[num_chunks_++] = chunk;
+    }
+  }
+
+  /**
+   * Destroys the trailing chunks that hold no element below frames.
+   *
+   * @param frames  Number of elements to keep
+   */
+  void shrink(const std::uint32_t frames) {
+    while (num_chunks_ > 0 && capacity() - CHUNK_FRAMES >= frames) {
+      T* chunk = chunks_[--num_chunks_];
+      chunks_[num_chunks_] = NULL;
+      for (std::uint32_t i = 0; i < CHUNK_FRAMES; i++) {
+        chunk[i].~T();
+      }
+      if (mapped_) {
+        munmap(chunk, mappedBytes());
+      } else {
+        free(chunk);
+      }
+    }
+  }
+
+ private:
+  FrameArray(const FrameArray&);
+  FrameArray& operator=(const FrameArray&);
+
+  /**
+   * Size of a mapped chunk, rounded up to whole huge pages
+   */
+  static std::size_t mappedBytes() {
+    const std::size_t bytes = CHUNK_FRAMES * sizeof(T);
+    return (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+  }
+
+  /**
+   * Allocates the memory of one chunk.
+   *
+   * @return  The chunk, or NULL if out of memory.
+   */
+  void* allocChunk() const {
+    if (!mapped_) {
+      void* block;
+      return posix_memalign(&block, alignment_, CHUNK_FRAMES * sizeof(T)) == 0
+                 ? block : NULL;
+    }
+
+    // Map a huge page more than needed and cut off both ends, leaving a
+    // chunk that starts on a huge page boundary.
+    const std::size_t bytes = mappedBytes();
+    void* raw = mmap(NULL, bytes + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+      return NULL;
+    }
+    char* start = static_cast<char*>(raw);
+    char* chunk = reinterpret_cast<char*>(
+        (reinterpret_cast<std::uintptr_t>(start) + HUGE_PAGE_SIZE - 1) &
+        ~static_cast<std::uintptr_t>(HUGE_PAGE_SIZE - 1));
+    if (chunk != start) {
+      munmap(start, chunk - start);
+    }
+    if (start + HUGE_PAGE_SIZE != chunk) {
+      munmap(chunk + bytes, start + HUGE_PAGE_SIZE - chunk);
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(chunk, bytes, MADV_HUGEPAGE);
+#endif
+    if (prefault_) {
+      memset(chunk, 0, bytes);
+    }
+    return chunk;
+  }
+
+  /**
+   * Alignment of every heap chunk
+   */
+  std::size_t alignment_;
+
+  /**
+   * True if chunks are mapped rather than taken from the heap
+   */
+  bool mapped_;
+
+  /**
+   * True if mapped chunks are touched when allocated
+   */
+  bool prefault_;
+
+  /**
+   * Chunk directory; chunk i holds elements i * CHUNK_FRAMES and up
+   */
+  T** chunks_;
+
+  /**
+   * Number of chunks allocated
+   */
+  std::uint32_t num_chunks_;
+};
+
+}
@@ -0,0 +1,492 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include "io_engine.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+
+// The io_uring engine is only built where the kernel headers describe the
+// ring and its system calls; elsewhere only the worker threads are.
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define BADGERDB_IO_URING 1
+#endif
+#endif
+#endif
+
+namespace badgerdb {
+
+/**
+ * Runs one request with a blocking system call and returns its result as
+ * IoRequest::done expects it.
+ */
+static ssize_t runRequest(IoRequest& request) {
+  ssize_t n;
+  do {
+    n = request.op == IoRequest::READ
+            ? preadv(request.fd, &request.iov[0],
+                     static_cast<int>(request.iov.size()), request.offset)
+            : pwritev(request.fd, &request.iov[0],
+                      static_cast<int>(request.iov.size()), request.offset);
+  } while (n < 0 && errno == EINTR);
+  return n < 0 ? -errno : n;
+}
+
+/**
+ * @brief Engine whose worker threads run the requests with preadv() and
+ *        pwritev().  Works everywhere; every request costs a thread switch.
+ */
+class ThreadPoolIoEngine : public IoEngine {
+ public:
+  explicit ThreadPoolIoEngine(const unsigned threads) : stopping_(false) {
+    for (unsigned i = 0; i < threads; ++i) {
+      workers_.push_back(std::thread(&ThreadPoolIoEngine::work, this));
+    }
+  }
+
+  ~ThreadPoolIoEngine() {
+    {
+      std::lock_guard<std::mutex> guard(latch_);
+      stopping_ = true;
+    }
+    queued_.notify_all();
+    for (std::size_t i = 0; i < workers_.size(); ++i) {
+      workers_[i].join();
+    }
+  }
+
+  void submit(IoRequest* const* requests, const std::size_t count) {
+    std::unique_lock<std::mutex> guard(latch_);
+    for (std::size_t i = 0; i < count; ++i) {
+      while (queue_.size() >= QUEUE_DEPTH) {
+        room_.wait(guard);
+      }
+      queue_.push_back(requests[i]);
+      queued_.notify_one();
+    }
+  }
+
+  const char* name() const { return "threads"; }
+
+ private:
+  /**
+   * Runs requests until the engine stops and the queue is empty.
+   */
+  void work() {
+    std::unique_lock<std::mutex> guard(latch_);
+    while (true) {
+      if (queue_.empty()) {
+        if (stopping_) {
+          return;
+        }
+        queued_.wait(guard);
+        continue;
+      }
+      IoRequest* request = queue_.front();
+      queue_.pop_front();
+      room_.notify_one();
+      guard.unlock();
+      request->done(runRequest(*request));
+      delete request;
+      guard.lock();
+    }
+  }
+
+  std::vector<std::thread> workers_;
+
+  /**
+   * Requests not yet taken by a worker
+   */
+  std::deque<IoRequest*> queue_;
+
+  bool stopping_;
+
+  /**
+   * Protects queue_ and stopping_
+   */
+  std::mutex latch_;
+  std::condition_variable queued_;
+  std::condition_variable room_;
+};
+
+#ifdef BADGERDB_IO_URING
+
+/**
+ * @brief Engine on an io_uring, driven by raw system calls.
+ *
+ * Submitters fill submission queue entries under a latch and enter the
+ * kernel once per batch.  A reaper thread waits for completions and runs
+ * the callbacks.  The number of requests in flight is kept within the
+ * submission queue, so the completion queue, twice its size, never
+ * overflows.  If waiting for completions fails for good, the requests in
+ * flight fail with the error and later requests run synchronously in
+ * submit().
+ */
+class UringIoEngine : public IoEngine {
+ public:
+  /**
+   * Sets up a ring with the given number of entries.
+   *
+   * @return  The engine, or NULL if the kernel refuses the ring.
+   */
+  static UringIoEngine* tryCreate(const unsigned entries) {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    const int fd = static_cast<int>(
+        syscall(__NR_io_uring_setup, entries, &params));
+    if (fd < 0) {
+      return NULL;
+    }
+    UringIoEngine* engine = new UringIoEngine(fd, params);
+    if (!engine->mapRings()) {
+      delete engine;
+      return NULL;
+    }
+    engine->reaper_ = std::thread(&UringIoEngine::reap, engine);
+    return engine;
+  }
+
+  ~UringIoEngine() {
+    if (reaper_.joinable()) {
+      // Wait for the requests in flight, then wake the reaper with an
+      // entry it knows to stop on.
+      std::unique_lock<std::mutex> guard(latch_);
+      while (in_flight_ > 0) {
+        room_.wait(guard);
+      }
+      if (!broken_) {
+        io_uring_sqe* sqe = nextEntry();
+        sqe->opcode = IORING_OP_NOP;
+        sqe->user_data = 0;
+        publish(1);
+      }
+      guard.unlock();
+      reaper_.join();
+    }
+    if (sqes_ != MAP_FAILED) {
+      munmap(sqes_, sqes_size_);
+    }
+    if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+      munmap(cq_ring_, cq_ring_size_);
+    }
+    if (sq_ring_ != MAP_FAILED) {
+      munmap(sq_ring_, sq_ring_size_);
+    }
+    ::close(fd_);
+  }
+
+  void submit(IoRequest* const* requests, const std::size_t count) {
+    std::unique_lock<std::mutex> guard(latch_);
+    std::size_t next = 0;
+    while (next < count) {
+      while (!broken_ && in_flight_ == params_.sq_entries) {
+        room_.wait(guard);
+      }
+      if (broken_) {
+        // The reaper has stopped; run the rest here, one after another.
+        guard.unlock();
+        for (; next < count; ++next) {
+          requests[next]->done(runRequest(*requests[next]));
+          delete requests[next];
+        }
+        return;
+      }
+      // Fill as many entries as there is room for, then enter once.
+      const unsigned batch = static_cast<unsigned>(std::min<std::size_t>(
+          count - next, params_.sq_entries - in_flight_));
+      for (unsigned i = 0; i < batch; ++i) {
+        IoRequest* request = requests[next++];
+        io_uring_sqe* sqe = nextEntry();
+        sqe->opcode = request->op == IoRequest::READ ? IORING_OP_READV
+                                                     : IORING_OP_WRITEV;
+        sqe->fd = request->fd;
+        sqe->off = request->offset;
+        sqe->addr = reinterpret_cast<std::uintptr_t>(&request->iov[0]);
+        sqe->len = static_cast<std::uint32_t>(request->iov.size());
+        sqe->user_data = reinterpret_cast<std::uintptr_t>(request);
+        pending_.insert(request);
+      }
+      in_flight_ += batch;
+      publish(batch);
+    }
+  }
+
+  const char* name() const { return "io_uring"; }
+
+ private:
+  UringIoEngine(const int fd, const io_uring_params& params)
+      : fd_(fd),
+        params_(params),
+        sq_ring_(MAP_FAILED),
+        cq_ring_(MAP_FAILED),
+        sqes_(MAP_FAILED),
+        in_flight_(0),
+        broken_(false) {}
+
+  /**
+   * Maps the submission and completion rings and the entry array.
+   *
+   * @return  False if a mapping fails.
+   */
+  bool mapRings() {
+    sq_ring_size_ = params_.sq_off.array + params_.sq_entries * sizeof(__u32);
+    cq_ring_size_ =
+        params_.cq_off.cqes + params_.cq_entries * sizeof(io_uring_cqe);
+    const bool single = (params_.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single) {
+      sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+    sq_ring_ = mmap(NULL, sq_ring_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED) {
+      return false;
+    }
+    cq_ring_ = single ? sq_ring_
+                      : mmap(NULL, cq_ring_size_, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, fd_,
+                             IORING_OFF_CQ_RING);
+    if (cq_ring_ == MAP_FAILED) {
+      return false;
+    }
+    sqes_size_ = params_.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = mmap(NULL, sqes_size_, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+    if (sqes_ == MAP_FAILED) {
+      return false;
+    }
+    char* sq = static_cast<char*>(sq_ring_);
+    sq_tail_ = reinterpret_cast<__u32*>(sq + params_.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<__u32*>(sq + params_.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<__u32*>(sq + params_.sq_off.array);
+    char* cq = static_cast<char*>(cq_ring_);
+    cq_head_ = reinterpret_cast<__u32*>(cq + params_.cq_off.head);
+    cq_tail_ = reinterpret_cast<__u32*>(cq + params_.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<__u32*>(cq + params_.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params_.cq_off.cqes);
+    sq_pending_tail_ = *sq_tail_;
+    return true;
+  }
+
+  /**
+   * Returns the next free submission entry, cleared.  Caller holds latch_
+   * and has made sure there is room.
+   */
+  io_uring_sqe* nextEntry() {
+    const __u32 index = sq_pending_tail_ & sq_mask_;
+    io_uring_sqe* sqe = static_cast<io_uring_sqe*>(sqes_) + index;
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array_[index] = index;
+    ++sq_pending_tail_;
+    return sqe;
+  }
+
+  /**
+   * Hands the last count entries filled to the kernel.  Caller holds latch_.
+   */
+  void publish(const unsigned count) {
+    __atomic_store_n(sq_tail_, sq_pending_tail_, __ATOMIC_RELEASE);
+    unsigned submitted = 0;
+    while (submitted < count) {
+      const long n =
+          syscall(__NR_io_uring_enter, fd_, count - submitted, 0, 0, NULL, 0);
+      if (n < 0) {
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+          std::this_thread::yield();
+          continue;
+        }
+        // The ring is unusable; fail the requests not taken by the kernel.
+        failUnsubmitted(count - submitted, errno);
+        return;
+      }
+      submitted += static_cast<unsigned>(n);
+    }
+  }
+
+  /**
+   * Takes back the last count entries the kernel did not consume and
+   * completes their requests with the given error.  Caller holds latch_.
+   */
+  void failUnsubmitted(const unsigned count, const int error) {
+    sq_pending_tail_ -= count;
+    __atomic_store_n(sq_tail_, sq_pending_tail_, __ATOMIC_RELEASE);
+    for (unsigned i = 0; i < count; ++i) {
+      const __u32 index = (sq_pending_tail_ + i) & sq_mask_;
+      IoRequest* request = reinterpret_cast<IoRequest*>(
+          static_cast<std::uintptr_t>(
+              (static_cast<io_uring_sqe*>(sqes_) + index)->user_data));
+      if (request != NULL) {
+        pending_.erase(request);
+        request->done(-error);
+        delete request;
+        --in_flight_;
+      }
+    }
+    room_.notify_all();
+  }
+
+  /**
+   * Waits for completions and runs their callbacks until the stop entry
+   * completes or waiting fails for good.
+   */
+  void reap() {
+    while (true) {
+      const long n = syscall(__NR_io_uring_enter, fd_, 0, 1,
+                             IORING_ENTER_GETEVENTS, NULL, 0);
+      const int error = n < 0 ? errno : 0;
+      const bool stop = drain();
+      if (error != 0 && error != EINTR && error != EAGAIN && error != EBUSY) {
+        failPending(error);
+        return;
+      }
+      if (stop) {
+        return;
+      }
+    }
+  }
+
+  /**
+   * Runs the callbacks of the completions posted so far.
+   *
+   * @return  True if the stop entry was among them.
+   */
+  bool drain() {
+    std::vector<std::pair<IoRequest*, int> > completed;
+    bool stop = false;
+    __u32 head = *cq_head_;
+    const __u32 tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+      const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+      IoRequest* request = reinterpret_cast<IoRequest*>(
+          static_cast<std::uintptr_t>(cqe.user_data));
+      if (request == NULL) {
+        stop = true;
+      } else {
+        completed.push_back(std::make_pair(request, cqe.res));
+      }
+      ++head;
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    if (completed.empty()) {
+      return stop;
+    }
+    {
+      std::lock_guard<std::mutex> guard(latch_);
+      for (std::size_t i = 0; i < completed.size(); ++i) {
+        pending_.erase(completed[i].first);
+      }
+      in_flight_ -= static_cast<unsigned>(completed.size());
+      room_.notify_all();
+    }
+    for (std::size_t i = 0; i < completed.size(); ++i) {
+      completed[i].first->done(completed[i].second);
+      delete completed[i].first;
+    }
+    return stop;
+  }
+
+  /**
+   * Marks the ring broken and completes every request in flight with the
+   * given error.  Called by the reaper just before it stops.
+   */
+  void failPending(const int error) {
+    std::vector<IoRequest*> failed;
+    {
+      std::lock_guard<std::mutex> guard(latch_);
+      broken_ = true;
+      failed.assign(pending_.begin(), pending_.end());
+      pending_.clear();
+      in_flight_ = 0;
+      room_.notify_all();
+    }
+    for (std::size_t i = 0; i < failed.size(); ++i) {
+      failed[i]->done(-error);
+      delete failed[i];
+    }
+  }
+
+  const int fd_;
+  const io_uring_params params_;
+
+  void* sq_ring_;
+  std::size_t sq_ring_size_;
+  void* cq_ring_;
+  std::size_t cq_ring_size_;
+  void* sqes_;
+  std::size_t sqes_size_;
+
+  __u32* sq_tail_;
+  __u32 sq_mask_;
+  __u32* sq_array_;
+  __u32* cq_head_;
+  __u32* cq_tail_;
+  __u32 cq_mask_;
+  io_uring_cqe* cqes_;
+
+  /**
+   * Tail of the submission queue including entries not yet published
+   */
+  __u32 sq_pending_tail_;
+
+  /**
+   * Number of requests submitted and not yet reaped
+   */
+  unsigned in_flight_;
+
+  /**
+   * Requests submitted and not yet reaped, failed if the reaper stops early
+   */
+  std::unordered_set<IoRequest*> pending_;
+
+  /**
+   * True once the reaper has stopped on an error; submit() then runs
+   * requests synchronously
+   */
+  bool broken_;
+
+  /**
+   * Protects the submission queue, in_flight_, pending_ and broken_
+   */
+  std::mutex latch_;
+  std::condition_variable room_;
+
+  std::thread reaper_;
+};
+
+#endif  // BADGERDB_IO_URING
+
+IoEngine* IoEngine::create(const IoEngineType type) {
+#ifdef BADGERDB_IO_URING
+  if (type != IO_ENGINE_THREADS) {
+    IoEngine* engine = UringIoEngine::tryCreate(QUEUE_DEPTH);
+    if (engine != NULL || type == IO_ENGINE_URING) {
+      return engine;
+    }
+  }
+#else
+  if (type == IO_ENGINE_URING) {
+    return NULL;
+  }
+#endif
+  return new ThreadPoolIoEngine(WORKER_THREADS);
+}
+
+}
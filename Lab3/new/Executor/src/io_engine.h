@@ -0,0 +1,116 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+namespace badgerdb {
+
+/**
+ * @brief Kinds of engine IoEngine::create() can make.
+ */
+enum IoEngineType {
+  IO_ENGINE_AUTO,    // io_uring if the kernel allows it, else worker threads
+  IO_ENGINE_URING,   // io_uring only
+  IO_ENGINE_THREADS  // worker threads doing preadv() and pwritev()
+};
+
+/**
+ * @brief One read or write submitted to an IoEngine.
+ */
+struct IoRequest {
+  enum Op {
+    READ,
+    WRITE
+  };
+
+  Op op;
+
+  /**
+   * Descriptor of the file to read or write
+   */
+  int fd;
+
+  /**
+   * Offset in the file of the first byte
+   */
+  off_t offset;
+
+  /**
+   * Buffers to fill or write, one after another; at most IOV_MAX
+   */
+  std::vector<iovec> iov;
+
+  /**
+   * Called once the request is done, with the number of bytes transferred,
+   * which may be short, or -errno.  Runs on a thread of the engine, so it
+   * must not block on other requests of the same engine.
+   */
+  std::function<void(const ssize_t result)> done;
+};
+
+/**
+ * @brief Engine that runs reads and writes in the background and reports
+ *        their completion through callbacks.
+ *
+ * Submitters hand a batch of requests to submit(), which queues them and
+ * returns at once unless the queue is full.  Completions are reaped by the
+ * engine's own threads, which call each request's callback.
+ */
+class IoEngine {
+ public:
+  /**
+   * Number of requests an engine keeps in flight before submit() waits
+   */
+  static const unsigned QUEUE_DEPTH = 128;
+
+  /**
+   * Number of worker threads of the thread pool engine
+   */
+  static const unsigned WORKER_THREADS = 4;
+
+  /**
+   * Makes an engine of the given type.
+   *
+   * @param type  Kind of engine
+   * @return  The engine, or NULL if type is IO_ENGINE_URING and the kernel
+   *          does not allow io_uring or the tree was built without it.
+   */
+  static IoEngine* create(const IoEngineType type = IO_ENGINE_AUTO);
+
+  /**
+   * Waits until every request submitted has completed, then stops the
+   * engine's threads.
+   */
+  virtual ~IoEngine() {}
+
+  /**
+   * Queues a batch of requests, taking ownership of them.  Waits only if
+   * the engine already has QUEUE_DEPTH requests in flight.
+   *
+   * @param requests  Requests to run, in any order
+   * @param count     Number of requests
+   */
+  virtual void submit(IoRequest* const* requests, const std::size_t count) = 0;
+
+  /**
+   * Queues one request, taking ownership of it.
+   */
+  void submit(IoRequest* request) { submit(&request, 1); }
+
+  /**
+   * Returns "io_uring" or "threads".
+   */
+  virtual const char* name() const = 0;
+};
+
+}
@@ -187,6 +187,8 @@ int main() {
   // Create buffer pool
   int availableBufPages = 256;
   BufMgr* bufMgr = new BufMgr(availableBufPages);
+  // Temporary files of the joins get a pool of their own.
+  bufMgr->createPool(TEMP_POOL, availableBufPages / 2);
 
   // Create system catalog
   Catalog* catalog = new Catalog("lab3");
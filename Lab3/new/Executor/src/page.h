@@ -204,7 +204,7 @@ class Page {
    *
    * @return  Iterator at first record of page.
    */
-  PageIterator begin();
+  PageIterator begin() const;
 
   /**
    * Returns an iterator representing the record after the last record in the
@@ -212,7 +212,7 @@ class Page {
    *
    * @return  Iterator representing record after the last record in the page.
    */
-  PageIterator end();
+  PageIterator end() const;
 
  private:
   /**
@@ -327,10 +327,11 @@ class Page {
 
   /**
    * Data stored on the page.  Includes bookkeeping information about slots as
-   * well as actual content.
+   * well as actual content.  Follows the header directly, so a page is one
+   * contiguous block of SIZE bytes that can be read, written or copied as a
+   * whole.
    */
-
-  std::string data_;
+  char data_[DATA_SIZE];
 
   friend class File;
   friend class PageIterator;
@@ -342,5 +343,7 @@ static_assert(Page::SIZE > sizeof(PageHeader),
               "Page size must be large enough to hold header and data.");
 static_assert(Page::DATA_SIZE > 0,
               "Page must have some space to hold data.");
+static_assert(sizeof(Page) == Page::SIZE,
+              "Header and data must fill the page without padding.");
 
 }
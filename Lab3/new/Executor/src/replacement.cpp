@@ -0,0 +1,511 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University
+ * of Wisconsin-Madison.
+ */
+
+#include "replacement.h"
+
+#include <algorithm>
+
+#include "buffer.h"
+
+namespace badgerdb {
+
+ReplacementPolicy* ReplacementPolicy::create(ReplacementPolicyType type,
+                                             std::uint32_t numBufs) {
+  switch (type) {
+    case POLICY_LRU:
+      return new LRUPolicy(numBufs);
+    case POLICY_LRU_K:
+      return new LRUKPolicy(numBufs);
+    case POLICY_TWO_Q:
+      return new TwoQPolicy(numBufs);
+    case POLICY_ARC:
+      return new ARCPolicy(numBufs);
+    case POLICY_CLOCK:
+    default:
+      return new ClockPolicy(numBufs);
+  }
+}
+
+ReplacementPolicy::ReplacementPolicy(std::uint32_t numBufs)
+    : numBufs(numBufs), queued(numBufs, false), ignoreKeepHot(false),
+      bufDescTable(NULL) {}
+
+bool ReplacementPolicy::isValid(const FrameId frame) const {
+  return (*bufDescTable)[frame].valid;
+}
+
+bool ReplacementPolicy::isPinned(const FrameId frame) const {
+  return (*bufDescTable)[frame].pinCnt > 0;
+}
+
+std::atomic<bool>& ReplacementPolicy::refbit(const FrameId frame) {
+  return (*bufDescTable)[frame].refbit;
+}
+
+AccessHint ReplacementPolicy::hint(const FrameId frame) const {
+  return (*bufDescTable)[frame].hint;
+}
+
+bool ReplacementPolicy::isEvictable(const FrameId frame) const {
+  return !isPinned(frame) && (ignoreKeepHot || hint(frame) != HINT_KEEP_HOT);
+}
+
+void ReplacementPolicy::resize(std::uint32_t numBufs) {
+  this->numBufs = numBufs;
+  queued.resize(numBufs, false);
+}
+
+bool ReplacementPolicy::chooseVictim(FrameId& frame, const File* file,
+                                     const PageId pageNo) {
+  while (!hinted.empty()) {
+    const FrameId candidate = hinted.front();
+    hinted.pop_front();
+    if (candidate >= numBufs) continue;
+    queued[candidate] = false;
+    // The hint may have been dropped since, e.g. the page was replaced.
+    const AccessHint h = hint(candidate);
+    if (isValid(candidate) && !isPinned(candidate) &&
+        (h == HINT_EVICT_NEXT || h == HINT_SEQUENTIAL_ONCE)) {
+      frame = candidate;
+      return true;
+    }
+  }
+  if (pickVictim(frame, file, pageNo)) return true;
+  ignoreKeepHot = true;
+  const bool found = pickVictim(frame, file, pageNo);
+  ignoreKeepHot = false;
+  return found;
+}
+
+void ReplacementPolicy::queueVictim(const FrameId frame, const bool first) {
+  if (queued[frame]) return;
+  queued[frame] = true;
+  if (first) {
+    hinted.push_front(frame);
+  } else {
+    hinted.push_back(frame);
+  }
+}
+
+void ReplacementPolicy::victimOrder(std::vector<FrameId>& frames,
+                                    std::uint32_t max) {
+  for (FrameId i = 0; i < numBufs && frames.size() < max; i++) {
+    if (isValid(i)) frames.push_back(i);
+  }
+}
+
+/*
+ * Clock
+ */
+
+ClockPolicy::ClockPolicy(std::uint32_t numBufs)
+    : ReplacementPolicy(numBufs), clockHand(numBufs - 1) {}
+
+void ClockPolicy::resize(std::uint32_t numBufs) {
+  ReplacementPolicy::resize(numBufs);
+  if (clockHand >= numBufs) clockHand = numBufs - 1;
+}
+
+void ClockPolicy::advanceClock() {
+  clockHand = (clockHand + 1) % numBufs;
+}
+
+bool ClockPolicy::pickVictim(FrameId& frame, const File* file,
+                             const PageId pageNo) {
+  // Two full turns are enough: the first clears every reference bit, so the
+  // second must stop at any frame that is not pinned.
+  for (std::uint32_t i = 0; i < 2 * numBufs; i++) {
+    advanceClock();
+    if (!isEvictable(clockHand)) {
+      continue;
+    } else if (!isValid(clockHand)) {
+      frame = clockHand;
+      return true;
+    } else if (refbit(clockHand)) {
+      refbit(clockHand) = false;
+    } else {
+      frame = clockHand;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ClockPolicy::victimOrder(std::vector<FrameId>& frames,
+                              std::uint32_t max) {
+  // The hand has already passed its own frame, so start just after it.
+  for (std::uint32_t i = 1; i <= numBufs && frames.size() < max; i++) {
+    const FrameId frame = (clockHand + i) % numBufs;
+    if (isValid(frame)) frames.push_back(frame);
+  }
+}
+
+/*
+ * FrameList
+ */
+
+FrameList::FrameList(std::uint32_t numBufs)
+    : pos(numBufs), member(numBufs, false), count(0) {}
+
+void FrameList::resize(std::uint32_t numBufs) {
+  pos.resize(numBufs);
+  member.resize(numBufs, false);
+}
+
+void FrameList::pushBack(const FrameId frame) {
+  if (member[frame]) {
+    frames.erase(pos[frame]);
+  } else {
+    member[frame] = true;
+    count++;
+  }
+  pos[frame] = frames.insert(frames.end(), frame);
+}
+
+void FrameList::remove(const FrameId frame) {
+  if (!member[frame]) return;
+  frames.erase(pos[frame]);
+  member[frame] = false;
+  count--;
+}
+
+/*
+ * ListPolicy
+ */
+
+ListPolicy::ListPolicy(std::uint32_t numBufs)
+    : ReplacementPolicy(numBufs), resident(numBufs) {}
+
+void ListPolicy::resize(std::uint32_t numBufs) {
+  ReplacementPolicy::resize(numBufs);
+  resident.resize(numBufs);
+}
+
+bool ListPolicy::firstUnpinned(FrameList& list, FrameId& frame) {
+  for (FrameList::iterator it = list.begin(); it != list.end(); ++it) {
+    if (isEvictable(*it)) {
+      frame = *it;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ListPolicy::appendFrames(FrameList& list, std::vector<FrameId>& frames,
+                              std::uint32_t max) {
+  for (FrameList::iterator it = list.begin();
+       it != list.end() && frames.size() < max; ++it) {
+    frames.push_back(*it);
+  }
+}
+
+/*
+ * LRU
+ */
+
+LRUPolicy::LRUPolicy(std::uint32_t numBufs)
+    : ListPolicy(numBufs), lru(numBufs) {}
+
+bool LRUPolicy::pickVictim(FrameId& frame, const File* file,
+                           const PageId pageNo) {
+  return firstUnpinned(lru, frame);
+}
+
+void LRUPolicy::victimOrder(std::vector<FrameId>& frames, std::uint32_t max) {
+  appendFrames(lru, frames, max);
+}
+
+void LRUPolicy::resize(std::uint32_t numBufs) {
+  ListPolicy::resize(numBufs);
+  lru.resize(numBufs);
+}
+
+void LRUPolicy::onLoad(const FrameId frame, const File* file,
+                       const PageId pageNo) {
+  lru.pushBack(frame);
+}
+
+void LRUPolicy::onHit(const FrameId frame) { lru.pushBack(frame); }
+
+void LRUPolicy::onEvict(const FrameId frame) {
+  lru.remove(frame);
+}
+
+void LRUPolicy::onDispose(const FrameId frame) { onEvict(frame); }
+
+/*
+ * LRU-K
+ */
+
+LRUKPolicy::LRUKPolicy(std::uint32_t numBufs, std::uint32_t k)
+    : ListPolicy(numBufs),
+      k(std::max<std::uint32_t>(k, 1)),
+      now(0),
+      history(numBufs, History(this->k, 0)) {}
+
+LRUKPolicy::OrderKey LRUKPolicy::orderKey(const FrameId frame) const {
+  const History& h = history[frame];
+  const OrderKey key = {h[k - 1], h[0], frame};
+  return key;
+}
+
+void LRUKPolicy::reference(const FrameId frame) {
+  order.erase(orderKey(frame));
+  History& h = history[frame];
+  for (std::uint32_t i = k - 1; i > 0; i--) h[i] = h[i - 1];
+  h[0] = ++now;
+  order.insert(orderKey(frame));
+}
+
+bool LRUKPolicy::pickVictim(FrameId& frame, const File* file,
+                            const PageId pageNo) {
+  // Only the pinned or kept-hot frames at the head of the order are passed.
+  for (std::set<OrderKey>::const_iterator it = order.begin();
+       it != order.end(); ++it) {
+    if (isValid(it->frame) && isEvictable(it->frame)) {
+      frame = it->frame;
+      return true;
+    }
+  }
+  return false;
+}
+
+void LRUKPolicy::victimOrder(std::vector<FrameId>& frames, std::uint32_t max) {
+  for (std::set<OrderKey>::const_iterator it = order.begin();
+       it != order.end() && frames.size() < max; ++it) {
+    frames.push_back(it->frame);
+  }
+}
+
+void LRUKPolicy::resize(std::uint32_t numBufs) {
+  ListPolicy::resize(numBufs);
+  history.resize(numBufs, History(k, 0));
+}
+
+void LRUKPolicy::onLoad(const FrameId frame, const File* file,
+                        const PageId pageNo) {
+  const PageKey key = {file, pageNo};
+  resident[frame] = key;
+  order.erase(orderKey(frame));
+  std::map<PageKey, Retained>::iterator it = retained.find(key);
+  if (it != retained.end()) {
+    history[frame] = it->second.history;
+    retained.erase(it);
+  } else {
+    std::fill(history[frame].begin(), history[frame].end(), 0);
+  }
+  reference(frame);
+}
+
+void LRUKPolicy::onHit(const FrameId frame) { reference(frame); }
+
+void LRUKPolicy::onEvict(const FrameId frame) {
+  order.erase(orderKey(frame));
+  Retained& entry = retained[resident[frame]];
+  entry.history = history[frame];
+  entry.evicted = now;
+  retainedOrder.push_back(std::make_pair(resident[frame], now));
+  // Stale entries in retainedOrder (pages that came back, or were evicted
+  // again since) erase nothing.
+  while (retained.size() > numBufs && !retainedOrder.empty()) {
+    std::map<PageKey, Retained>::iterator it =
+        retained.find(retainedOrder.front().first);
+    if (it != retained.end() &&
+        it->second.evicted == retainedOrder.front().second) {
+      retained.erase(it);
+    }
+    retainedOrder.pop_front();
+  }
+  if (retainedOrder.size() > 4 * numBufs) {
+    std::deque<std::pair<PageKey, std::uint64_t> > live;
+    for (std::size_t i = 0; i < retainedOrder.size(); i++) {
+      std::map<PageKey, Retained>::const_iterator it =
+          retained.find(retainedOrder[i].first);
+      if (it != retained.end() && it->second.evicted == retainedOrder[i].second) {
+        live.push_back(retainedOrder[i]);
+      }
+    }
+    retainedOrder.swap(live);
+  }
+}
+
+void LRUKPolicy::onDispose(const FrameId frame) {
+  order.erase(orderKey(frame));
+}
+
+/*
+ * 2Q
+ */
+
+TwoQPolicy::TwoQPolicy(std::uint32_t numBufs)
+    : ListPolicy(numBufs),
+      kin(std::max<std::uint32_t>(numBufs / 4, 1)),
+      kout(std::max<std::uint32_t>(numBufs / 2, 1)),
+      a1in(numBufs),
+      am(numBufs) {}
+
+bool TwoQPolicy::pickVictim(FrameId& frame, const File* file,
+                            const PageId pageNo) {
+  if (a1in.size() > kin && firstUnpinned(a1in, frame)) return true;
+  return firstUnpinned(am, frame) || firstUnpinned(a1in, frame);
+}
+
+void TwoQPolicy::victimOrder(std::vector<FrameId>& frames, std::uint32_t max) {
+  appendFrames(a1in, frames, max);
+  appendFrames(am, frames, max);
+}
+
+void TwoQPolicy::resize(std::uint32_t numBufs) {
+  ListPolicy::resize(numBufs);
+  kin = std::max<std::uint32_t>(numBufs / 4, 1);
+  kout = std::max<std::uint32_t>(numBufs / 2, 1);
+  a1in.resize(numBufs);
+  am.resize(numBufs);
+}
+
+void TwoQPolicy::onLoad(const FrameId frame, const File* file,
+                        const PageId pageNo) {
+  const PageKey key = {file, pageNo};
+  resident[frame] = key;
+  std::map<PageKey, std::list<PageKey>::iterator>::iterator it =
+      a1outIndex.find(key);
+  if (it != a1outIndex.end()) {
+    a1out.erase(it->second);
+    a1outIndex.erase(it);
+    am.pushBack(frame);
+  } else {
+    a1in.pushBack(frame);
+  }
+}
+
+void TwoQPolicy::onHit(const FrameId frame) {
+  // A1in is a FIFO; correlated re-references there do not promote the page.
+  if (am.contains(frame)) am.pushBack(frame);
+}
+
+void TwoQPolicy::onEvict(const FrameId frame) {
+  if (a1in.contains(frame)) {
+    a1in.remove(frame);
+    const PageKey& key = resident[frame];
+    a1outIndex[key] = a1out.insert(a1out.end(), key);
+    while (a1out.size() > kout) {
+      a1outIndex.erase(a1out.front());
+      a1out.pop_front();
+    }
+  } else {
+    am.remove(frame);
+  }
+}
+
+void TwoQPolicy::onDispose(const FrameId frame) {
+  a1in.remove(frame);
+  am.remove(frame);
+}
+
+/*
+ * ARC
+ */
+
+ARCPolicy::ARCPolicy(std::uint32_t numBufs)
+    : ListPolicy(numBufs), p(0), t1(numBufs), t2(numBufs) {}
+
+void ARCPolicy::ghostRemove(GhostList& list, GhostIndex& index,
+                            const PageKey& key) {
+  GhostIndex::iterator it = index.find(key);
+  if (it == index.end()) return;
+  list.erase(it->second);
+  index.erase(it);
+}
+
+void ARCPolicy::ghostPushBack(GhostList& list, GhostIndex& index,
+                              const PageKey& key) {
+  index[key] = list.insert(list.end(), key);
+}
+
+void ARCPolicy::ghostPopFront(GhostList& list, GhostIndex& index) {
+  index.erase(list.front());
+  list.pop_front();
+}
+
+bool ARCPolicy::pickVictim(FrameId& frame, const File* file,
+                           const PageId pageNo) {
+  const PageKey key = {file, pageNo};
+  const bool inB2 = b2Index.count(key) > 0;
+  if (t1.size() > 0 && (t1.size() > p || (inB2 && t1.size() == p))) {
+    if (firstUnpinned(t1, frame)) return true;
+    return firstUnpinned(t2, frame);
+  }
+  return firstUnpinned(t2, frame) || firstUnpinned(t1, frame);
+}
+
+void ARCPolicy::victimOrder(std::vector<FrameId>& frames, std::uint32_t max) {
+  if (t1.size() > p) {
+    appendFrames(t1, frames, max);
+    appendFrames(t2, frames, max);
+  } else {
+    appendFrames(t2, frames, max);
+    appendFrames(t1, frames, max);
+  }
+}
+
+void ARCPolicy::resize(std::uint32_t numBufs) {
+  ListPolicy::resize(numBufs);
+  p = std::min(p, numBufs);
+  t1.resize(numBufs);
+  t2.resize(numBufs);
+}
+
+void ARCPolicy::onLoad(const FrameId frame, const File* file,
+                       const PageId pageNo) {
+  const PageKey key = {file, pageNo};
+  resident[frame] = key;
+  if (b1Index.count(key)) {
+    const std::uint32_t delta =
+        std::max<std::uint32_t>(b2.size() / b1.size(), 1);
+    p = std::min(p + delta, numBufs);
+    ghostRemove(b1, b1Index, key);
+    t2.pushBack(frame);
+  } else if (b2Index.count(key)) {
+    const std::uint32_t delta =
+        std::max<std::uint32_t>(b1.size() / b2.size(), 1);
+    p = p > delta ? p - delta : 0;
+    ghostRemove(b2, b2Index, key);
+    t2.pushBack(frame);
+  } else {
+    // Keep |T1| + |B1| <= c and the whole directory within 2c.
+    if (t1.size() + b1.size() >= numBufs && !b1.empty()) {
+      ghostPopFront(b1, b1Index);
+    } else if (t1.size() + t2.size() + b1.size() + b2.size() >= 2 * numBufs &&
+               !b2.empty()) {
+      ghostPopFront(b2, b2Index);
+    }
+    t1.pushBack(frame);
+  }
+}
+
+void ARCPolicy::onHit(const FrameId frame) {
+  t1.remove(frame);
+  t2.pushBack(frame);
+}
+
+void ARCPolicy::onEvict(const FrameId frame) {
+  if (t1.contains(frame)) {
+    t1.remove(frame);
+    ghostPushBack(b1, b1Index, resident[frame]);
+  } else if (t2.contains(frame)) {
+    t2.remove(frame);
+    ghostPushBack(b2, b2Index, resident[frame]);
+  }
+}
+
+void ARCPolicy::onDispose(const FrameId frame) {
+  t1.remove(frame);
+  t2.remove(frame);
+}
+
+}  // namespace badgerdb
@@ -0,0 +1,527 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University
+ * of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "file.h"
+#include "types.h"
+
+namespace badgerdb {
+
+class BufDesc;
+template <class T>
+class FrameArray;
+
+/**
+ * @brief Replacement policies shipped with the buffer manager.
+ */
+enum ReplacementPolicyType {
+  POLICY_CLOCK,
+  POLICY_LRU,
+  POLICY_LRU_K,
+  POLICY_TWO_Q,
+  POLICY_ARC
+};
+
+/**
+ * @brief What a caller knows about its future use of a page, passed to
+ * BufMgr::readPage() and BufMgr::unPinPage().
+ */
+enum AccessHint {
+  HINT_NORMAL,          // no hint; leaves an earlier hint in place
+  HINT_KEEP_HOT,        // replace the page only if nothing else can go
+  HINT_EVICT_NEXT,      // replace the page first once it is unpinned
+  HINT_SEQUENTIAL_ONCE  // read once by a scan; not a reuse, replace early
+};
+
+/**
+ * @brief Identity of a page independent of the frame that holds it.  Used by
+ * policies that remember pages after they have left the pool.
+ */
+struct PageKey {
+  /**
+   * File object the page belongs to
+   */
+  const File* file;
+
+  /**
+   * Page number within the file
+   */
+  PageId pageNo;
+
+  bool operator<(const PageKey& rhs) const {
+    return file < rhs.file || (file == rhs.file && pageNo < rhs.pageNo);
+  }
+
+  bool operator==(const PageKey& rhs) const {
+    return file == rhs.file && pageNo == rhs.pageNo;
+  }
+};
+
+/**
+ * @brief Interface between BufMgr and a page replacement policy.
+ *
+ * BufMgr owns the frames and their descriptors; the policy only decides which
+ * frame to hand out next.  BufMgr reports every pin, unpin and removal to the
+ * policy through the on*() hooks:
+ *
+ *   - onLoad()    a page was read or allocated into a frame and pinned (miss)
+ *   - onHit()     a resident page was pinned again by readPage()
+ *   - onUnpin()   the pin count of a frame dropped to zero
+ *   - onEvict()   the page left the pool but still exists in its file
+ *   - onDispose() the page was deleted from its file
+ *
+ * BufMgr hands out unused frames from its own free list and only calls
+ * pickVictim() once every frame holds a page or is being filled.  The frame
+ * returned must hold an unpinned page; BufMgr writes it back if necessary and
+ * then calls onEvict() for it.  Frames that are pinned must never be
+ * returned, even if they hold no page: BufMgr pins a frame while it is being
+ * filled.
+ *
+ * When the pool is resized, BufMgr first takes every page out of the frames
+ * that go away, then calls resize().
+ *
+ * Access hints are honored for every policy by chooseVictim(), which BufMgr
+ * calls instead of pickVictim(): frames queued with queueVictim() go first,
+ * and pickVictim() passes over frames hinted keep-hot as long as
+ * isEvictable() says so.
+ *
+ * BufMgr serializes all hooks on its pool latch, so implementations need no
+ * locking of their own.  Policies that do not need onHit() and onUnpin()
+ * should say so through needsAccessHooks(), which keeps buffer hits off the
+ * pool latch entirely.
+ */
+class ReplacementPolicy {
+  friend class BufMgr;
+
+ public:
+  /**
+   * Creates one of the built-in policies for a pool of numBufs frames.
+   *
+   * @param type     Policy to create
+   * @param numBufs  Number of frames in the buffer pool
+   * @return  Newly allocated policy; the caller takes ownership.
+   */
+  static ReplacementPolicy* create(ReplacementPolicyType type,
+                                   std::uint32_t numBufs);
+
+  /**
+   * Constructor of ReplacementPolicy class
+   *
+   * @param numBufs  Number of frames in the buffer pool
+   */
+  explicit ReplacementPolicy(std::uint32_t numBufs);
+
+  virtual ~ReplacementPolicy() {}
+
+  /**
+   * Returns a short name of the policy, e.g. for statistics output.
+   */
+  virtual const char* name() const = 0;
+
+  /**
+   * Returns false if onHit() and onUnpin() do nothing, so BufMgr can skip
+   * them (and the latch they are called under) on every access.
+   */
+  virtual bool needsAccessHooks() const { return true; }
+
+  /**
+   * Chooses a resident page to be replaced by the given page.
+   *
+   * @param frame   Frame ID of the chosen frame returned via this variable
+   * @param file    File of the page that is about to be brought in
+   * @param pageNo  Number of the page that is about to be brought in
+   * @return  False if every frame is pinned.
+   */
+  virtual bool pickVictim(FrameId& frame, const File* file,
+                          const PageId pageNo) = 0;
+
+  /**
+   * Chooses the frame to replace, honoring access hints: an unpinned frame
+   * queued by queueVictim() whose hint still asks for early replacement,
+   * else what pickVictim() picks among frames not hinted keep-hot, else
+   * what it picks among all frames.
+   *
+   * @return  False if every frame is pinned.
+   */
+  bool chooseVictim(FrameId& frame, const File* file, const PageId pageNo);
+
+  /**
+   * Queues a frame that was unpinned with an evict-next or sequential-once
+   * hint for replacement ahead of the policy's own choice.
+   *
+   * @param frame  Frame to queue
+   * @param first  Put the frame before all queued frames, not after them
+   */
+  void queueVictim(const FrameId frame, const bool first);
+
+  /**
+   * Lists resident frames in the order the policy expects to replace them.
+   * Used by the background writer to clean pages before they are picked.
+   * The default lists frames in index order.
+   *
+   * @param frames  Receives up to max frame IDs
+   * @param max     Maximum number of frames to list
+   */
+  virtual void victimOrder(std::vector<FrameId>& frames, std::uint32_t max);
+
+  /**
+   * Adapts the policy to a buffer pool of numBufs frames.  Frames that are
+   * dropped hold no page.
+   *
+   * @param numBufs  New number of frames in the buffer pool
+   */
+  virtual void resize(std::uint32_t numBufs);
+
+  virtual void onLoad(const FrameId /* frame */, const File* /* file */,
+                      const PageId /* pageNo */) {}
+
+  virtual void onHit(const FrameId /* frame */) {}
+
+  virtual void onUnpin(const FrameId /* frame */) {}
+
+  virtual void onEvict(const FrameId /* frame */) {}
+
+  virtual void onDispose(const FrameId /* frame */) {}
+
+ protected:
+  /**
+   * Number of frames in the buffer pool
+   */
+  std::uint32_t numBufs;
+
+  /**
+   * True if the frame currently holds a page
+   */
+  bool isValid(const FrameId frame) const;
+
+  /**
+   * True if the frame is pinned and can therefore not be replaced
+   */
+  bool isPinned(const FrameId frame) const;
+
+  /**
+   * Reference bit of the frame as kept in its descriptor
+   */
+  std::atomic<bool>& refbit(const FrameId frame);
+
+  /**
+   * Access hint of the frame as kept in its descriptor
+   */
+  AccessHint hint(const FrameId frame) const;
+
+  /**
+   * True if pickVictim() may choose the frame: it is not pinned and, unless
+   * only kept-hot frames are left, not hinted keep-hot
+   */
+  bool isEvictable(const FrameId frame) const;
+
+ private:
+  /**
+   * Frames queued by queueVictim(), next victim first, and whether each
+   * frame is in the queue
+   */
+  std::deque<FrameId> hinted;
+  std::vector<bool> queued;
+
+  /**
+   * Set while chooseVictim() lets pickVictim() take kept-hot frames
+   */
+  bool ignoreKeepHot;
+
+  /**
+   * Descriptor table of the owning BufMgr, set when the policy is attached
+   */
+  const FrameArray<BufDesc>* bufDescTable;
+};
+
+/**
+ * @brief Second-chance clock sweep over the descriptor table.
+ */
+class ClockPolicy : public ReplacementPolicy {
+ public:
+  explicit ClockPolicy(std::uint32_t numBufs);
+
+  const char* name() const { return "CLOCK"; }
+
+  bool needsAccessHooks() const { return false; }
+
+  bool pickVictim(FrameId& frame, const File* file, const PageId pageNo);
+  void victimOrder(std::vector<FrameId>& frames, std::uint32_t max);
+  void resize(std::uint32_t numBufs);
+
+ private:
+  /**
+   * Current position of clockhand in our buffer pool
+   */
+  FrameId clockHand;
+
+  /**
+   * Advance clock to next frame in the buffer pool
+   */
+  void advanceClock();
+};
+
+/**
+ * @brief Ordered set of frame IDs supporting O(1) append, removal and
+ * membership tests.  A frame is in at most one FrameList of a policy.
+ */
+class FrameList {
+ public:
+  typedef std::list<FrameId>::iterator iterator;
+
+  explicit FrameList(std::uint32_t numBufs);
+
+  void pushBack(const FrameId frame);
+  void remove(const FrameId frame);
+  void resize(std::uint32_t numBufs);
+  bool contains(const FrameId frame) const { return member[frame]; }
+  std::uint32_t size() const { return count; }
+
+  iterator begin() { return frames.begin(); }
+  iterator end() { return frames.end(); }
+
+ private:
+  std::list<FrameId> frames;
+  std::vector<iterator> pos;
+  std::vector<bool> member;
+  std::uint32_t count;
+};
+
+/**
+ * @brief Base for the list-based policies, which keep resident frames on
+ * FrameLists in replacement order.
+ */
+class ListPolicy : public ReplacementPolicy {
+ public:
+  explicit ListPolicy(std::uint32_t numBufs);
+
+  void resize(std::uint32_t numBufs);
+
+ protected:
+  /**
+   * Page held by every frame, recorded at onLoad()
+   */
+  std::vector<PageKey> resident;
+
+  /**
+   * Returns the first frame of the list in list order that isEvictable()
+   *
+   * @return  False if every frame on the list is pinned or kept hot.
+   */
+  bool firstUnpinned(FrameList& list, FrameId& frame);
+
+  /**
+   * Appends the frames of the list to frames, up to max frames in total
+   */
+  static void appendFrames(FrameList& list, std::vector<FrameId>& frames,
+                           std::uint32_t max);
+};
+
+/**
+ * @brief Exact least-recently-used replacement.
+ */
+class LRUPolicy : public ListPolicy {
+ public:
+  explicit LRUPolicy(std::uint32_t numBufs);
+
+  const char* name() const { return "LRU"; }
+
+  bool pickVictim(FrameId& frame, const File* file, const PageId pageNo);
+  void victimOrder(std::vector<FrameId>& frames, std::uint32_t max);
+  void resize(std::uint32_t numBufs);
+  void onLoad(const FrameId frame, const File* file, const PageId pageNo);
+  void onHit(const FrameId frame);
+  void onEvict(const FrameId frame);
+  void onDispose(const FrameId frame);
+
+ private:
+  /**
+   * Resident frames, least recently used first
+   */
+  FrameList lru;
+};
+
+/**
+ * @brief LRU-K (O'Neil et al.): replaces the page whose K-th most recent
+ * reference lies furthest in the past.  Pages with fewer than K references
+ * go first, oldest last reference first.  Reference history of evicted pages
+ * is retained for up to numBufs pages.
+ */
+class LRUKPolicy : public ListPolicy {
+ public:
+  LRUKPolicy(std::uint32_t numBufs, std::uint32_t k = 2);
+
+  const char* name() const { return "LRU-K"; }
+
+  bool pickVictim(FrameId& frame, const File* file, const PageId pageNo);
+  void victimOrder(std::vector<FrameId>& frames, std::uint32_t max);
+  void resize(std::uint32_t numBufs);
+  void onLoad(const FrameId frame, const File* file, const PageId pageNo);
+  void onHit(const FrameId frame);
+  void onEvict(const FrameId frame);
+  void onDispose(const FrameId frame);
+
+ private:
+  typedef std::vector<std::uint64_t> History;
+
+  /**
+   * Position of a resident frame in replacement order: largest backward
+   * K-distance, that is smallest K-th reference time, first; pages without
+   * K references tie at zero and fall back to plain LRU.
+   */
+  struct OrderKey {
+    std::uint64_t kth;
+    std::uint64_t last;
+    FrameId frame;
+
+    bool operator<(const OrderKey& rhs) const {
+      if (kth != rhs.kth) return kth < rhs.kth;
+      if (last != rhs.last) return last < rhs.last;
+      return frame < rhs.frame;
+    }
+  };
+
+  /**
+   * History of an evicted page, with the time it was evicted
+   */
+  struct Retained {
+    History history;
+    std::uint64_t evicted;
+  };
+
+  /**
+   * Number of references tracked per page
+   */
+  std::uint32_t k;
+
+  /**
+   * Logical time, advanced on every reference
+   */
+  std::uint64_t now;
+
+  /**
+   * Reference times of the page in each frame, most recent first; 0 means
+   * no such reference
+   */
+  std::vector<History> history;
+
+  /**
+   * Resident frames in replacement order
+   */
+  std::set<OrderKey> order;
+
+  /**
+   * Reference history of pages that were evicted
+   */
+  std::map<PageKey, Retained> retained;
+
+  /**
+   * Eviction order of retained histories, oldest first, with the eviction
+   * time; an entry whose time differs from the retained one is stale
+   */
+  std::deque<std::pair<PageKey, std::uint64_t> > retainedOrder;
+
+  /**
+   * Returns the position of the frame in order
+   */
+  OrderKey orderKey(const FrameId frame) const;
+
+  void reference(const FrameId frame);
+};
+
+/**
+ * @brief Full 2Q (Johnson & Shasha): first references go to the A1in FIFO,
+ * pages referenced again after leaving A1in are promoted to the Am LRU.
+ */
+class TwoQPolicy : public ListPolicy {
+ public:
+  explicit TwoQPolicy(std::uint32_t numBufs);
+
+  const char* name() const { return "2Q"; }
+
+  bool pickVictim(FrameId& frame, const File* file, const PageId pageNo);
+  void victimOrder(std::vector<FrameId>& frames, std::uint32_t max);
+  void resize(std::uint32_t numBufs);
+  void onLoad(const FrameId frame, const File* file, const PageId pageNo);
+  void onHit(const FrameId frame);
+  void onEvict(const FrameId frame);
+  void onDispose(const FrameId frame);
+
+ private:
+  /**
+   * Target size of A1in and maximum size of A1out
+   */
+  std::uint32_t kin, kout;
+
+  /**
+   * Resident pages seen once (FIFO) and resident hot pages (LRU)
+   */
+  FrameList a1in, am;
+
+  /**
+   * Pages recently evicted from A1in, oldest first
+   */
+  std::list<PageKey> a1out;
+  std::map<PageKey, std::list<PageKey>::iterator> a1outIndex;
+};
+
+/**
+ * @brief Adaptive replacement cache (Megiddo & Modha).  Balances a recency
+ * list T1 against a frequency list T2 using the ghost lists B1 and B2.
+ */
+class ARCPolicy : public ListPolicy {
+ public:
+  explicit ARCPolicy(std::uint32_t numBufs);
+
+  const char* name() const { return "ARC"; }
+
+  bool pickVictim(FrameId& frame, const File* file, const PageId pageNo);
+  void victimOrder(std::vector<FrameId>& frames, std::uint32_t max);
+  void resize(std::uint32_t numBufs);
+  void onLoad(const FrameId frame, const File* file, const PageId pageNo);
+  void onHit(const FrameId frame);
+  void onEvict(const FrameId frame);
+  void onDispose(const FrameId frame);
+
+ private:
+  typedef std::list<PageKey> GhostList;
+  typedef std::map<PageKey, GhostList::iterator> GhostIndex;
+
+  /**
+   * Target size of T1
+   */
+  std::uint32_t p;
+
+  /**
+   * Resident pages seen once and seen at least twice, LRU first
+   */
+  FrameList t1, t2;
+
+  /**
+   * Ghosts of pages evicted from T1 and T2, LRU first
+   */
+  GhostList b1, b2;
+  GhostIndex b1Index, b2Index;
+
+  static void ghostRemove(GhostList& list, GhostIndex& index,
+                          const PageKey& key);
+  static void ghostPushBack(GhostList& list, GhostIndex& index,
+                            const PageKey& key);
+  static void ghostPopFront(GhostList& list, GhostIndex& index);
+};
+
+}  // namespace badgerdb
@@ -19,27 +19,25 @@ RecordId HeapFileManager::insertTuple(const string& tuple,
     RecordId record; //iterator
     bool flag = false;
     // Iterate through all pages in the file.
-    Page *pagepoint;
     PageId pageNo;
     for (FileIterator iter = (file).begin();
          iter != (file).end();
          ++iter) {
         Page page = *iter;
         pageNo = page.page_number();
-        bufMgr->readPage(&file, pageNo, pagepoint);
+        PageHandle pagepoint = bufMgr->readPage(&file, pageNo);
         if(pagepoint->hasSpaceForRecord(tuple)){
             flag = true;
             record = pagepoint->insertRecord(tuple);
-            bufMgr->unPinPage(&file, pageNo, true);
+            pagepoint.markDirty();
             break;
         }
-        bufMgr->unPinPage(&file, pageNo, false);
     }
     //Create a new page
     if (!flag){
-        bufMgr->allocPage(&file, pageNo, pagepoint);
+        PageHandle pagepoint = bufMgr->allocPage(&file);
         record = pagepoint->insertRecord(tuple);
-        bufMgr->unPinPage(&file, pageNo, true);
+        pagepoint.markDirty();
     }
     return record;
 }
@@ -0,0 +1,257 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+// Concurrency stress test of the buffer pool.  Several threads read and
+// unpin random pages of a file much larger than the pool, while the main
+// thread grows the pool and shrinks it back.  Hits look the page up without
+// a page table latch and pin it under the latch of its frame, misses evict
+// pages and so delete page table entries, and growing the pool makes the
+// page table partitions grow.  At the end
+// the pool's bookkeeping and every page on disk are checked.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "buffer.h"
+#include "exceptions/file_not_found_exception.h"
+#include "page.h"
+
+using namespace badgerdb;
+
+namespace {
+
+/**
+ * Frames of the pool at the start and end of each run
+ */
+const std::uint32_t POOL_FRAMES = 64;
+
+/**
+ * Frames of the pool while it is grown, enough to make every page table
+ * partition grow
+ */
+const std::uint32_t GROWN_FRAMES = 1024;
+
+/**
+ * Pages in the file, four times the grown pool
+ */
+const std::uint32_t FILE_PAGES = 4096;
+
+/**
+ * Pages below this number belong to one thread each, which bumps a
+ * counter in them; the others are only read
+ */
+const std::uint32_t WRITABLE_PAGES = FILE_PAGES / 2;
+
+const char* const FILENAME = "stress.db";
+
+const char* const POLICY_NAMES[] = {"clock", "lru", "lru-k", "2q", "arc"};
+
+/**
+ * Returns the record stored in the page: its number and how often its
+ * owner has bumped it.
+ */
+std::string pageRecord(const PageId pageNo, const std::uint32_t count) {
+  char record[32];
+  std::snprintf(record, sizeof(record), "page %08u count %08u", pageNo, count);
+  return record;
+}
+
+/**
+ * State shared by the threads of one run
+ */
+struct StressRun {
+  StressRun(BufMgr* pool, File* target, const unsigned threadCount)
+      : bufMgr(pool), file(target), threads(threadCount), done(0),
+        failures(0) {}
+
+  BufMgr* bufMgr;
+  File* file;
+  const unsigned threads;
+  std::vector<RecordId> rids;
+
+  /**
+   * Count each writable page should hold, kept by its owner
+   */
+  std::vector<std::uint32_t> counts;
+
+  /**
+   * Operations finished by all threads
+   */
+  std::atomic<std::uint64_t> done;
+
+  std::atomic<unsigned> failures;
+  std::mutex messageLatch;
+  std::string firstFailure;
+
+  void fail(const std::string& message) {
+    if (failures++ == 0) {
+      std::lock_guard<std::mutex> guard(messageLatch);
+      firstFailure = message;
+    }
+  }
+};
+
+/**
+ * Reads and unpins random pages.  Pages of the thread's own stripe of the
+ * writable pages get their counter bumped; all pages are checked to hold
+ * their own number.
+ */
+void worker(StressRun* run, const unsigned id, const std::uint32_t iterations) {
+  std::minstd_rand random(id + 1);
+  for (std::uint32_t i = 0; i < iterations; i++, run->done++) {
+    PageId pageNo = 1 + random() % (FILE_PAGES - 1);
+    const bool own = pageNo < WRITABLE_PAGES;
+    if (own) {
+      // Move to the page of this thread's stripe, so no other thread
+      // touches it.
+      pageNo = pageNo - pageNo % run->threads + id;
+      if (pageNo == 0 || pageNo >= WRITABLE_PAGES) {
+        continue;
+      }
+    }
+    Page* page;
+    try {
+      run->bufMgr->readPage(run->file, pageNo, page);
+    } catch (const std::exception& e) {
+      run->fail(std::string("readPage: ") + e.what());
+      continue;
+    }
+    const std::string record = page->getRecord(run->rids[pageNo]);
+    bool dirty = false;
+    if (record.compare(0, 13, pageRecord(pageNo, 0), 0, 13) != 0) {
+      run->fail("page " + std::to_string(pageNo) + " holds " + record);
+    } else if (own) {
+      std::uint32_t& count = run->counts[pageNo];
+      if (record != pageRecord(pageNo, count)) {
+        run->fail("page " + std::to_string(pageNo) + " lost an update: " +
+                  record);
+      }
+      page->updateRecord(run->rids[pageNo], pageRecord(pageNo, ++count));
+      dirty = true;
+    }
+    try {
+      run->bufMgr->unPinPage(run->file, pageNo, dirty);
+    } catch (const std::exception& e) {
+      run->fail(std::string("unPinPage: ") + e.what());
+    }
+  }
+}
+
+/**
+ * Waits until the threads have finished the given number of operations.
+ */
+void waitFor(const StressRun& run, const std::uint64_t operations) {
+  while (run.done < operations && run.failures == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+/**
+ * Runs the stress test once with the given policy.
+ *
+ * @return  True if no check failed.
+ */
+bool stress(const ReplacementPolicyType policy, const unsigned threads,
+            const std::uint32_t iterations) {
+  try {
+    File::remove(FILENAME);
+  } catch (const FileNotFoundException&) {
+  }
+  bool ok;
+  {
+    File file = File::create(FILENAME);
+    BufMgr* bufMgr = new BufMgr(POOL_FRAMES, policy);
+    StressRun run(bufMgr, &file, threads);
+    run.rids.resize(FILE_PAGES);
+    run.counts.assign(FILE_PAGES, 0);
+    // Page 0 is the file header, so page numbers start at 1.
+    for (PageId pageNo = 1; pageNo < FILE_PAGES; pageNo++) {
+      Page page = file.allocatePage();
+      run.rids[page.page_number()] =
+          page.insertRecord(pageRecord(page.page_number(), 0));
+      file.writePage(page);
+    }
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; t++) {
+      workers.push_back(std::thread(worker, &run, t, iterations));
+    }
+    const std::uint64_t total = std::uint64_t(threads) * iterations;
+    waitFor(run, total / 3);
+    const std::uint32_t grown = bufMgr->resize(GROWN_FRAMES);
+    waitFor(run, 2 * total / 3);
+    const std::uint32_t shrunk = bufMgr->resize(POOL_FRAMES);
+    for (unsigned t = 0; t < threads; t++) {
+      workers[t].join();
+    }
+
+    const std::string broken = bufMgr->checkInvariants();
+    if (!broken.empty()) {
+      run.fail(broken);
+    }
+    try {
+      // Fails if a pin was leaked.
+      bufMgr->flushFile(&file);
+    } catch (const std::exception& e) {
+      run.fail(std::string("flushFile: ") + e.what());
+    }
+    for (PageId pageNo = 1; pageNo < FILE_PAGES; pageNo++) {
+      const std::string record = file.readPage(pageNo).getRecord(run.rids[pageNo]);
+      if (record != pageRecord(pageNo, run.counts[pageNo])) {
+        run.fail("page " + std::to_string(pageNo) + " on disk holds " + record);
+        break;
+      }
+    }
+
+    const BufStats& stats = bufMgr->getBufStats();
+    std::cout << POLICY_NAMES[policy] << ": " << total << " ops, "
+              << stats.hits << " hits, " << stats.misses << " misses, "
+              << stats.evictions << " evictions, frames " << POOL_FRAMES
+              << " -> " << grown << " -> " << shrunk << ": ";
+    ok = run.failures == 0;
+    if (ok) {
+      std::cout << "OK" << std::endl;
+    } else {
+      std::cout << run.failures << " failures, first: " << run.firstFailure
+                << std::endl;
+    }
+    delete bufMgr;
+  }
+  File::remove(FILENAME);
+  return ok;
+}
+
+}
+
+int main(int argc, char** argv) {
+  const unsigned threads = argc > 1 ? std::atoi(argv[1]) : 8;
+  const std::uint32_t iterations = argc > 2 ? std::atoi(argv[2]) : 20000;
+  if (threads == 0 || threads > WRITABLE_PAGES) {
+    std::cerr << "usage: " << argv[0] << " [threads] [iterations]" << std::endl;
+    return 2;
+  }
+
+  bool ok = true;
+  const ReplacementPolicyType policies[] = {POLICY_CLOCK, POLICY_LRU,
+                                            POLICY_LRU_K, POLICY_TWO_Q,
+                                            POLICY_ARC};
+  for (std::size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+    ok = stress(policies[i], threads, iterations) && ok;
+  }
+
+  std::cout << (ok ? "Stress Completed" : "Stress Failed") << std::endl;
+  return ok ? 0 : 1;
+}